@@ -0,0 +1,146 @@
+/*
+ * Barrier benchmarks
+ *
+ * barrier_phase: threads go through phases, waiting for each other at the end
+ * of each of them with barrier_wait(); the time per operation is the time of
+ * a phase transition, from the last thread arriving to all of them running
+ * again, since the phases themselves do nothing.
+ * sem_barrier_phase: the same with a barrier emulated with semaphores, where
+ * the last thread to arrive releases the others with one sem_up() each.
+ *
+ * Both run with 2 to MAX_THREADS threads, the main thread being one of them.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <barrier.h>
+#include <sem.h>
+
+#include "harness.h"
+
+#define PHASES		1000
+#define MAX_THREADS	256
+
+/*
+ * Barrier emulated with semaphores: arriving threads count themselves under
+ * mutex, and wait on the gate of the phase, which the last of them opens for
+ * each of the others. Phases alternate between two gates, so that a thread
+ * already arriving for the next phase cannot take the place of one which has
+ * yet to leave the previous one.
+ */
+static struct {
+	sem_t mutex;
+	sem_t gates[2];
+	unsigned int arrived;
+	unsigned int count;
+} emul;
+
+static barrier_t barrier;
+static int use_sem;
+
+static void emul_wait(unsigned int *phase)
+{
+	sem_t gate = emul.gates[*phase];
+	unsigned int i;
+
+	*phase ^= 1;
+
+	sem_down(emul.mutex);
+	if (++emul.arrived == emul.count) {
+		emul.arrived = 0;
+		sem_up(emul.mutex);
+		for (i = 1; i < emul.count; i++)
+			sem_up(gate);
+	} else {
+		sem_up(emul.mutex);
+		sem_down(gate);
+	}
+}
+
+/* Ends the current phase of the calling thread */
+static void phase_wait(unsigned int *phase)
+{
+	if (use_sem)
+		emul_wait(phase);
+	else
+		barrier_wait(barrier);
+}
+
+/* Goes through @arg phases, plus a first one where all threads started */
+static void *worker(void *arg)
+{
+	unsigned long i, ops = *(unsigned long*)arg;
+	unsigned int phase = 0;
+
+	for (i = 0; i <= ops; i++)
+		phase_wait(&phase);
+
+	return NULL;
+}
+
+/* Runs @ops phases with @threads threads, and returns the time of one */
+static double run(unsigned int threads, unsigned long ops)
+{
+	pthread_t tids[MAX_THREADS];
+	unsigned int phase = 0;
+	double start, elapsed;
+	unsigned long i;
+
+	barrier = barrier_create(threads);
+	emul.mutex = sem_create(1);
+	emul.gates[0] = sem_create(0);
+	emul.gates[1] = sem_create(0);
+	emul.arrived = 0;
+	emul.count = threads;
+
+	for (i = 1; i < threads; i++)
+		pthread_create(&tids[i], NULL, worker, &ops);
+
+	/* Waits for all threads to start, then times the other phases */
+	phase_wait(&phase);
+
+	start = bench_now();
+	for (i = 0; i < ops; i++)
+		phase_wait(&phase);
+	elapsed = bench_now() - start;
+
+	for (i = 1; i < threads; i++)
+		pthread_join(tids[i], NULL);
+
+	barrier_destroy(barrier);
+	sem_destroy(emul.mutex);
+	sem_destroy(emul.gates[0]);
+	sem_destroy(emul.gates[1]);
+
+	return elapsed / ops;
+}
+
+static void bench_phase(const char *name, int sem)
+{
+	static const unsigned int counts[] = { 2, 4, 16, 64, MAX_THREADS };
+	unsigned long ops = bench_ops(PHASES);
+	int n = bench_samples(), i, c;
+	double *samples = malloc(n * sizeof(double));
+
+	use_sem = sem;
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		run(counts[c], ops);
+		for (i = 0; i < n; i++)
+			samples[i] = run(counts[c], ops);
+		bench_report(name, counts[c], 0, samples, n, ops);
+	}
+
+	free(samples);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init("barrier", argc, argv);
+
+	bench_phase("barrier_phase", 0);
+	bench_phase("sem_barrier_phase", 1);
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Semaphore benchmarks
+ *
+ * sem_uncontended: each thread takes and releases a semaphore of its own.
+ * sem_contended: all threads take and release the same semaphore of count 1.
+ * sem_pingpong: two threads hand a resource back and forth through two
+ * semaphores, so that each round trip blocks and wakes each thread once. Each
+ * round trip is a sample of its own, so that percentiles show wake latency.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <sem.h>
+
+#include "harness.h"
+
+#define OPS		1000000
+#define ROUNDS		10000
+#define MAX_THREADS	4
+
+struct worker {
+	pthread_t tid;
+	sem_t sem;
+	unsigned long ops;
+};
+
+static sem_t ping, pong;
+
+static void *down_up(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long i;
+
+	for (i = 0; i < w->ops; i++) {
+		sem_down(w->sem);
+		sem_up(w->sem);
+	}
+
+	return NULL;
+}
+
+/* Runs @threads workers, sharing one semaphore if @shared, @ops times each */
+static double run(unsigned int threads, int shared, unsigned long ops)
+{
+	struct worker workers[MAX_THREADS];
+	double start, elapsed;
+	unsigned int i;
+
+	for (i = 0; i < threads; i++) {
+		workers[i].sem = (shared && i > 0) ? workers[0].sem : sem_create(1);
+		workers[i].ops = ops;
+	}
+
+	start = bench_now();
+	for (i = 0; i < threads; i++)
+		pthread_create(&workers[i].tid, NULL, down_up, &workers[i]);
+	for (i = 0; i < threads; i++)
+		pthread_join(workers[i].tid, NULL);
+	elapsed = bench_now() - start;
+
+	for (i = 0; i < threads; i++)
+		if (!shared || i == 0)
+			sem_destroy(workers[i].sem);
+
+	return elapsed / (ops * threads);
+}
+
+static void bench_down_up(const char *name, int shared)
+{
+	static const unsigned int counts[] = { 1, 2, MAX_THREADS };
+	unsigned long ops = bench_ops(OPS);
+	int n = bench_samples(), i, c;
+	double *samples = malloc(n * sizeof(double));
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		if (shared && counts[c] == 1)
+			continue;
+
+		run(counts[c], shared, ops);
+		for (i = 0; i < n; i++)
+			samples[i] = run(counts[c], shared, ops);
+		bench_report(name, counts[c], 0, samples, n, ops);
+	}
+
+	free(samples);
+}
+
+static void *ponger(void *arg)
+{
+	unsigned long i, rounds = *(unsigned long*)arg;
+
+	for (i = 0; i < rounds; i++) {
+		sem_down(ping);
+		sem_up(pong);
+	}
+
+	return NULL;
+}
+
+static void bench_pingpong(void)
+{
+	unsigned long i, rounds = bench_ops(ROUNDS);
+	double *samples = malloc(rounds * sizeof(double));
+	double start;
+	pthread_t tid;
+
+	ping = sem_create(0);
+	pong = sem_create(0);
+	pthread_create(&tid, NULL, ponger, &rounds);
+
+	for (i = 0; i < rounds; i++) {
+		start = bench_now();
+		sem_up(ping);
+		sem_down(pong);
+		samples[i] = bench_now() - start;
+	}
+
+	pthread_join(tid, NULL);
+	sem_destroy(ping);
+	sem_destroy(pong);
+
+	/* The first round trips warm up */
+	bench_report("sem_pingpong", 2, 0, samples + rounds / 100,
+		     rounds - rounds / 100, 1);
+	free(samples);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init("sem", argc, argv);
+
+	bench_down_up("sem_uncontended", 0);
+	bench_down_up("sem_contended", 1);
+	bench_pingpong();
+
+	return 0;
+}
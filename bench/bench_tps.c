@@ -0,0 +1,155 @@
+/*
+ * TPS benchmarks
+ *
+ * tps_read, tps_write: each thread reads or writes a TPS of its own, at
+ * various sizes.
+ * tps_clone_cow: a thread clones a TPS of a certain size, writes a byte to it
+ * so that a page is copied on write, then destroys it.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tps.h>
+
+#include "harness.h"
+
+#define OPS		200000
+#define CLONES		2000
+#define MAX_THREADS	4
+#define AREA_SIZE	(16 * 4096)
+
+struct worker {
+	pthread_t tid;
+	size_t size;
+	int write;
+	unsigned long ops;
+};
+
+struct cloner {
+	pthread_t owner;
+	unsigned long ops;
+	double elapsed;
+};
+
+static void *transfer(void *arg)
+{
+	struct worker *w = arg;
+	char *buffer = calloc(1, w->size);
+	unsigned long i;
+
+	tps_create_sized(AREA_SIZE);
+	for (i = 0; i < w->ops; i++) {
+		if (w->write)
+			tps_write(0, w->size, buffer);
+		else
+			tps_read(0, w->size, buffer);
+	}
+	tps_destroy();
+
+	free(buffer);
+	return NULL;
+}
+
+/* Runs @threads workers transferring @size bytes @ops times each */
+static double run(unsigned int threads, size_t size, int write,
+		  unsigned long ops)
+{
+	struct worker workers[MAX_THREADS];
+	double start, elapsed;
+	unsigned int i;
+
+	start = bench_now();
+	for (i = 0; i < threads; i++) {
+		workers[i].size = size;
+		workers[i].write = write;
+		workers[i].ops = ops;
+		pthread_create(&workers[i].tid, NULL, transfer, &workers[i]);
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(workers[i].tid, NULL);
+	elapsed = bench_now() - start;
+
+	return elapsed / (ops * threads);
+}
+
+static void bench_transfer(const char *name, int write)
+{
+	static const unsigned int counts[] = { 1, 2, MAX_THREADS };
+	static const size_t sizes[] = { 8, 512, 4096, AREA_SIZE };
+	int n = bench_samples(), i, c, s;
+	double *samples = malloc(n * sizeof(double));
+	unsigned long ops;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		/* Keeps the time per sample about the same for every size */
+		ops = bench_ops(sizes[s] < 4096 ? OPS : OPS * 4096 / sizes[s] / 4);
+
+		for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+			run(counts[c], sizes[s], write, ops);
+			for (i = 0; i < n; i++)
+				samples[i] = run(counts[c], sizes[s], write, ops);
+			bench_report(name, counts[c], sizes[s], samples, n, ops);
+		}
+	}
+
+	free(samples);
+}
+
+static void *clone_cow(void *arg)
+{
+	struct cloner *c = arg;
+	double start = bench_now();
+	unsigned long i;
+	char byte = 1;
+
+	for (i = 0; i < c->ops; i++) {
+		tps_clone(c->owner);
+		tps_write(0, 1, &byte);
+		tps_destroy();
+	}
+
+	c->elapsed = bench_now() - start;
+	return NULL;
+}
+
+static void bench_clone(void)
+{
+	static const size_t sizes[] = { 4096, AREA_SIZE };
+	int n = bench_samples(), i, s;
+	double *samples = malloc(n * sizeof(double));
+	struct cloner c;
+	pthread_t tid;
+
+	c.owner = pthread_self();
+	c.ops = bench_ops(CLONES);
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		tps_create_sized(sizes[s]);
+
+		for (i = -1; i < n; i++) {
+			pthread_create(&tid, NULL, clone_cow, &c);
+			pthread_join(tid, NULL);
+			if (i >= 0)
+				samples[i] = c.elapsed / c.ops;
+		}
+		bench_report("tps_clone_cow", 1, sizes[s], samples, n, c.ops);
+
+		tps_destroy();
+	}
+
+	free(samples);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(tps_init(0) == 0 && tps_fast_access() ? "tps_pkeys" : "tps",
+		   argc, argv);
+
+	bench_transfer("tps_read", 0);
+	bench_transfer("tps_write", 1);
+	bench_clone();
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#define SAMPLES		20
+#define QUICK_SAMPLES	5
+
+static const char *benchSuite;
+static int benchSamples = SAMPLES;
+static int benchQuick;
+
+void bench_init(const char *suite, int argc, char **argv)
+{
+	int i;
+
+	benchSuite = suite;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-q")) {
+			benchQuick = 1;
+			benchSamples = QUICK_SAMPLES;
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			benchSamples = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "Usage: %s [-q] [-s samples]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (benchSamples < 1)
+		benchSamples = 1;
+
+	printf("{\"suite\":\"%s\",\"bench\":\"machine\",\"cpus\":%ld,"
+	       "\"samples\":%d,\"quick\":%d}\n", benchSuite,
+	       sysconf(_SC_NPROCESSORS_ONLN), benchSamples, benchQuick);
+}
+
+int bench_samples(void)
+{
+	return benchSamples;
+}
+
+unsigned long bench_ops(unsigned long ops)
+{
+	if (benchQuick)
+		ops /= 10;
+	return ops > 0 ? ops : 1;
+}
+
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const double *samples, int count, int p)
+{
+	int rank = (p * count + 99) / 100;
+
+	return samples[rank > 0 ? rank - 1 : 0];
+}
+
+void bench_report(const char *name, unsigned int threads, size_t size,
+		  double *samples, int count, unsigned long ops)
+{
+	double sum = 0, mean;
+	int i;
+
+	for (i = 0; i < count; i++)
+		sum += samples[i];
+	mean = sum / count;
+	qsort(samples, count, sizeof(double), compare);
+
+	printf("{\"suite\":\"%s\",\"bench\":\"%s\",\"threads\":%u,\"size\":%zu,"
+	       "\"samples\":%d,\"ops_per_sample\":%lu,\"ns_per_op\":%.1f,"
+	       "\"ops_per_sec\":%.0f,\"min_ns\":%.1f,\"p50_ns\":%.1f,"
+	       "\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f}\n",
+	       benchSuite, name, threads, size, count, ops, mean, 1e9 / mean,
+	       samples[0], percentile(samples, count, 50),
+	       percentile(samples, count, 90), percentile(samples, count, 99),
+	       samples[count - 1]);
+	fflush(stdout);
+}
@@ -0,0 +1,64 @@
+#ifndef _HARNESS_H
+#define _HARNESS_H
+
+#include <stddef.h>
+
+/*
+ * Benchmark harness
+ *
+ * A benchmark takes a number of samples, each timing a fixed number of
+ * operations, after a warm-up sample which is thrown away. It reports the
+ * distribution of the time per operation across samples as one line of JSON,
+ * so that results can be collected and compared from one run to the next.
+ */
+
+/*
+ * bench_init - Initialize harness
+ * @suite: Name of the suite of benchmarks of the program
+ * @argc: Number of command line arguments
+ * @argv: Command line arguments
+ *
+ * Parse the options of the program: -q for a quick run, with fewer samples
+ * and fewer operations per sample, and -s followed by a number of samples.
+ * Print a line describing the machine the benchmarks run on.
+ */
+void bench_init(const char *suite, int argc, char **argv);
+
+/*
+ * bench_samples - Number of samples to take
+ *
+ * Return: Number of samples each benchmark should take.
+ */
+int bench_samples(void);
+
+/*
+ * bench_ops - Number of operations per sample
+ * @ops: Number of operations per sample for a full run
+ *
+ * Return: @ops for a full run, a tenth of @ops for a quick run, at least 1.
+ */
+unsigned long bench_ops(unsigned long ops);
+
+/*
+ * bench_now - Current time
+ *
+ * Return: Time of CLOCK_MONOTONIC in nanoseconds.
+ */
+double bench_now(void);
+
+/*
+ * bench_report - Report the result of a benchmark
+ * @name: Name of the benchmark
+ * @threads: Number of threads running it
+ * @size: Size of the data it operates on, in bytes, or 0
+ * @samples: Time per operation of each sample, in nanoseconds, sorted in place
+ * @count: Number of samples
+ * @ops: Number of operations per sample
+ *
+ * Print a line of JSON with the mean, minimum, maximum and percentiles of the
+ * time per operation, and the number of operations per second.
+ */
+void bench_report(const char *name, unsigned int threads, size_t size,
+		  double *samples, int count, unsigned long ops);
+
+#endif /* _HARNESS_H */
@@ -0,0 +1,221 @@
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "barrier.h"
+#include "futex.h"
+
+/*
+ * Barrier struct
+ * remaining:	number of threads yet to arrive in the current phase
+ * phase:	number of the current phase, which waiting threads sleep on
+ *		as a futex until it changes
+ * inside:	number of threads in barrier_wait()
+ * count:	number of threads which wait for each other
+*/
+struct barrier {
+	atomic_int remaining;
+	atomic_int phase;
+	atomic_int inside;
+	int count;
+};
+
+/*
+ * Latch struct
+ * count:	number of countdowns left before the latch opens
+ * phase:	number of times the latch opened, which waiting threads sleep
+ *		on as a futex until it changes
+ * inside:	number of threads in latch_wait()
+*/
+struct latch {
+	atomic_int count;
+	atomic_int phase;
+	atomic_int inside;
+};
+
+/*
+ * Waiting threads all sleep on the same futex, the phase number, which the
+ * thread completing the phase increments before waking all of them up with a
+ * single system call. Threads remember the phase they wait for the end of, so
+ * that a thread which has yet to run when the next phase starts still leaves,
+ * and a barrier or a latch can be used again right away without reallocating
+ * anything: the last thread of a phase rearms the barrier before starting the
+ * next one, and latch_reset() rearms an open latch.
+ *
+ * A released thread may still be reading the phase when another one destroys
+ * the barrier or the latch, so they count the threads inside, and destroying
+ * them waits for those to leave.
+*/
+
+/* Helper function to wait for threads released from a phase to leave */
+static void waitInside(atomic_int *inside)
+{
+	while (atomic_load(inside) > 0)
+		sched_yield();
+}
+
+/* Helper function to sleep until 'phase' is no longer 'current' */
+static void phaseWait(atomic_int *phase, int current)
+{
+	while (atomic_load(phase) == current)
+		futex_wait(phase, current, NULL);
+}
+
+/* Helper function to end phase 'phase', releasing the threads waiting on it */
+static void phaseEnd(atomic_int *phase)
+{
+	atomic_fetch_add(phase, 1);
+	futex_wake(phase, INT_MAX);
+}
+
+/* Creates a barrier for 'count' threads */
+barrier_t barrier_create(size_t count)
+{
+	barrier_t newBarrier;
+
+	if (count == 0 || count > INT_MAX)
+		return NULL;
+
+	newBarrier = malloc(sizeof(struct barrier));
+	if (newBarrier == NULL)
+		return NULL;
+
+	atomic_init(&newBarrier->remaining, count);
+	atomic_init(&newBarrier->phase, 0);
+	atomic_init(&newBarrier->inside, 0);
+	newBarrier->count = count;
+
+	return newBarrier;
+}
+
+/* Destroys barrier if no thread is waiting on it */
+int barrier_destroy(barrier_t barrier)
+{
+	if (barrier == NULL)
+		return -1;
+	else if (atomic_load(&barrier->remaining) != barrier->count)
+		return -1;
+
+	waitInside(&barrier->inside);
+	free(barrier);
+
+	return 0;
+}
+
+/* Waits for all threads to arrive, the last one releasing the others */
+int barrier_wait(barrier_t barrier)
+{
+	int phase, ret = 0;
+
+	if (barrier == NULL)
+		return -1;
+
+	atomic_fetch_add(&barrier->inside, 1);
+
+	/* The phase cannot end before this thread arrives */
+	phase = atomic_load(&barrier->phase);
+	if (atomic_fetch_sub(&barrier->remaining, 1) == 1)
+	{
+		/* Rearms the barrier before any thread can arrive for the next phase */
+		atomic_store(&barrier->remaining, barrier->count);
+		phaseEnd(&barrier->phase);
+		ret = BARRIER_SERIAL_THREAD;
+	}
+	else
+		phaseWait(&barrier->phase, phase);
+
+	atomic_fetch_sub(&barrier->inside, 1);
+
+	return ret;
+}
+
+/* Creates a latch which opens after 'count' countdowns */
+latch_t latch_create(size_t count)
+{
+	latch_t newLatch;
+
+	if (count > INT_MAX)
+		return NULL;
+
+	newLatch = malloc(sizeof(struct latch));
+	if (newLatch == NULL)
+		return NULL;
+
+	atomic_init(&newLatch->count, count);
+	atomic_init(&newLatch->phase, 0);
+	atomic_init(&newLatch->inside, 0);
+
+	return newLatch;
+}
+
+/* Destroys latch if no thread is waiting on it */
+int latch_destroy(latch_t latch)
+{
+	if (latch == NULL)
+		return -1;
+	else if (atomic_load(&latch->count) > 0 && atomic_load(&latch->inside) > 0)
+		return -1;
+
+	waitInside(&latch->inside);
+	free(latch);
+
+	return 0;
+}
+
+/* Counts latch down by 'count', opening it if it reaches 0 */
+int latch_countdown(latch_t latch, size_t count)
+{
+	int left;
+
+	if (latch == NULL || count == 0)
+		return -1;
+
+	left = atomic_load(&latch->count);
+	do
+	{
+		if (count > (size_t)left)
+			return -1;
+	} while (!atomic_compare_exchange_weak(&latch->count, &left, left - count));
+
+	if ((size_t)left == count)
+		phaseEnd(&latch->phase);
+
+	return 0;
+}
+
+/* Waits until latch is open */
+int latch_wait(latch_t latch)
+{
+	int phase;
+
+	if (latch == NULL)
+		return -1;
+
+	atomic_fetch_add(&latch->inside, 1);
+
+	/* Reads the phase first, so that a reset after it opens is not missed */
+	phase = atomic_load(&latch->phase);
+	if (atomic_load(&latch->count) > 0)
+		phaseWait(&latch->phase, phase);
+
+	atomic_fetch_sub(&latch->inside, 1);
+
+	return 0;
+}
+
+/* Arms open latch again for 'count' countdowns */
+int latch_reset(latch_t latch, size_t count)
+{
+	int open = 0;
+
+	if (latch == NULL || count > INT_MAX)
+		return -1;
+
+	/* Fails if the latch is not open, or was armed again meanwhile */
+	if (!atomic_compare_exchange_strong(&latch->count, &open, count))
+		return -1;
+
+	return 0;
+}
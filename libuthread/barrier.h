@@ -0,0 +1,120 @@
+#ifndef _BARRIER_H
+#define _BARRIER_H
+
+#include <stddef.h>
+
+/*
+ * barrier_t - Barrier type
+ *
+ * A barrier makes a fixed number of threads wait for each other at the end of
+ * each phase of their work: threads calling barrier_wait() are blocked until
+ * the last of them arrives, which releases all of them at once and starts the
+ * next phase. The same barrier serves any number of phases in a row.
+ */
+typedef struct barrier *barrier_t;
+
+/*
+ * latch_t - Countdown latch type
+ *
+ * A latch lets threads wait until a count drops to 0, counted down by other
+ * threads, for instance for the workers of a phase to be done. Threads calling
+ * latch_wait() are blocked until then, and are all released at once. Once
+ * open, a latch can be armed again for the next phase with latch_reset().
+ */
+typedef struct latch *latch_t;
+
+/* Returned by barrier_wait() to the thread which completed the phase */
+#define BARRIER_SERIAL_THREAD 1
+
+/*
+ * barrier_create - Create barrier
+ * @count: Number of threads which wait for each other
+ *
+ * Return: Pointer to initialized barrier. NULL if @count is 0 or greater than
+ * INT_MAX, or in case of failure when allocating the new barrier.
+ */
+barrier_t barrier_create(size_t count);
+
+/*
+ * barrier_destroy - Deallocate a barrier
+ * @barrier: Barrier to deallocate
+ *
+ * Deallocate barrier @barrier, once the threads released by the last phase
+ * are out of barrier_wait().
+ *
+ * Return: -1 if @barrier is NULL or if threads are waiting on it. 0 if
+ * @barrier was successfully destroyed.
+ */
+int barrier_destroy(barrier_t barrier);
+
+/*
+ * barrier_wait - Wait for the other threads of the phase
+ * @barrier: Barrier to wait on
+ *
+ * Block the caller thread until as many threads as @barrier was created for
+ * have called barrier_wait() in the current phase. The last of them releases
+ * all the others at once, and the next phase starts.
+ *
+ * Return: -1 if @barrier is NULL. BARRIER_SERIAL_THREAD in the thread which
+ * completed the phase, and 0 in the others.
+ */
+int barrier_wait(barrier_t barrier);
+
+/*
+ * latch_create - Create countdown latch
+ * @count: Number of countdowns the latch waits for
+ *
+ * Return: Pointer to initialized latch, which is open if @count is 0. NULL if
+ * @count is greater than INT_MAX, or in case of failure when allocating the
+ * new latch.
+ */
+latch_t latch_create(size_t count);
+
+/*
+ * latch_destroy - Deallocate a countdown latch
+ * @latch: Latch to deallocate
+ *
+ * Deallocate latch @latch, once the threads it released are out of
+ * latch_wait().
+ *
+ * Return: -1 if @latch is NULL or if threads are waiting on it. 0 if @latch
+ * was successfully destroyed.
+ */
+int latch_destroy(latch_t latch);
+
+/*
+ * latch_countdown - Count a latch down
+ * @latch: Latch to count down
+ * @count: Number to count down by
+ *
+ * Decrease the count of @latch by @count, which opens it once it reaches 0,
+ * releasing all the threads waiting on it at once.
+ *
+ * Return: -1 if @latch is NULL, or if @count is 0 or greater than the count
+ * of @latch. 0 if @latch was successfully counted down.
+ */
+int latch_countdown(latch_t latch, size_t count);
+
+/*
+ * latch_wait - Wait for a latch to open
+ * @latch: Latch to wait on
+ *
+ * Block the caller thread until the count of @latch reaches 0, if it has not
+ * yet. A thread waiting while the latch opens is released even if the latch
+ * is armed again before it runs.
+ *
+ * Return: -1 if @latch is NULL. 0 once @latch is open.
+ */
+int latch_wait(latch_t latch);
+
+/*
+ * latch_reset - Arm a latch again
+ * @latch: Latch to arm
+ * @count: Number of countdowns the latch waits for in the next phase
+ *
+ * Return: -1 if @latch is NULL, if @count is greater than INT_MAX, or if
+ * @latch is not open yet. 0 if @latch was successfully armed.
+ */
+int latch_reset(latch_t latch, size_t count);
+
+#endif /* _BARRIER_H */
@@ -0,0 +1,515 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+#include "queue.h"
+#include "sem.h"
+
+/* Size of a cache line, to keep senders and receivers from sharing one */
+#define CACHE_LINE 64
+
+/*
+ * Slot struct
+ * seq:		position in the ring the slot can be sent to when equal to it,
+ *		or received from when equal to it plus one
+ * data:	data item held by the slot
+*/
+struct slot {
+	atomic_size_t seq;
+	void *data;
+};
+
+/*
+ * Party struct, on the stack of a thread blocked on an unbuffered channel
+ * link:	link in the intrusive queue of senders or receivers
+ * cond:	signaled when the thread is done waiting
+ * data:	items to send, or room for the items to receive
+ * count:	number of items left to send, or room for items to receive
+ * done:	number of items sent or received so far
+*/
+struct party {
+	struct queue_link link;
+	pthread_cond_t cond;
+	void **data;
+	size_t count;
+	size_t done;
+};
+
+/*
+ * Channel struct
+ * head:	position in the ring of the next item sent
+ * tail:	position in the ring of the next item received
+ * slots:	ring of slots, position p maps to slot p & mask
+ * mask:	number of slots minus one, the number of slots is a power of two
+ * sendWaiting:	number of senders waiting for the channel not to be full
+ * sendSem:	semaphore senders wait on
+ * recvWaiting:	number of receivers waiting for the channel not to be empty
+ * recvSem:	semaphore receivers wait on
+ * lock:	protects senders and receivers, for unbuffered channels
+ * senders:	intrusive queue of senders blocked on an unbuffered channel
+ * receivers:	intrusive queue of receivers blocked on an unbuffered channel
+*/
+struct channel {
+	_Alignas(CACHE_LINE) atomic_size_t head;
+	_Alignas(CACHE_LINE) atomic_size_t tail;
+	_Alignas(CACHE_LINE) struct slot *slots;
+	size_t mask;
+	atomic_int sendWaiting;
+	sem_t sendSem;
+	atomic_int recvWaiting;
+	sem_t recvSem;
+	pthread_mutex_t lock;
+	struct queue_list senders;
+	struct queue_list receivers;
+};
+
+/*
+ * Threads claim positions in the ring with a compare-and-swap on head or
+ * tail, after checking with the sequence number of the slot that it is free
+ * or full (Vyukov's bounded queue). A thread which finds the channel full or
+ * empty counts itself as waiting, tries again in case the channel changed in
+ * between, and only then waits on the semaphore. Threads which send or receive
+ * an item wake one waiting thread on the other side, if any, so semaphores are
+ * left alone as long as the channel is neither full nor empty.
+ *
+ * Unbuffered channels have no ring (slots is NULL): a sender copies its items
+ * straight to the receivers blocked on the channel and wakes them up, and
+ * blocks until receivers take the remaining items otherwise, and the other
+ * way around. Either way, each item crosses the channel in a single copy and
+ * with at most one thread to wake up.
+*/
+
+
+/* Creates a channel of at least 'capacity' slots, or an unbuffered one */
+channel_t channel_create(size_t capacity)
+{
+	channel_t newChannel;
+	size_t count = 2, i;
+
+	if (capacity > SIZE_MAX / 2 / sizeof(struct slot))
+		return NULL;
+
+	if (capacity == 0)
+	{
+		newChannel = aligned_alloc(CACHE_LINE, sizeof(struct channel));
+		if (newChannel == NULL)
+			return NULL;
+
+		newChannel->slots = NULL;
+		newChannel->mask = 0;
+		pthread_mutex_init(&newChannel->lock, NULL);
+		queue_list_init(&newChannel->senders);
+		queue_list_init(&newChannel->receivers);
+
+		return newChannel;
+	}
+
+	while (count < capacity)
+		count <<= 1;
+
+	newChannel = aligned_alloc(CACHE_LINE, sizeof(struct channel));
+	if (newChannel == NULL)
+		return NULL;
+
+	newChannel->slots = malloc(count * sizeof(struct slot));
+	newChannel->sendSem = sem_create(0);
+	newChannel->recvSem = sem_create(0);
+	if (newChannel->slots == NULL || newChannel->sendSem == NULL ||
+			newChannel->recvSem == NULL)
+	{
+		sem_destroy(newChannel->sendSem);
+		sem_destroy(newChannel->recvSem);
+		free(newChannel->slots);
+		free(newChannel);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+		atomic_init(&newChannel->slots[i].seq, i);
+	atomic_init(&newChannel->head, 0);
+	atomic_init(&newChannel->tail, 0);
+	newChannel->mask = count - 1;
+	atomic_init(&newChannel->sendWaiting, 0);
+	atomic_init(&newChannel->recvWaiting, 0);
+
+	return newChannel;
+}
+
+/* Destroys channel if no thread is waiting on it */
+int channel_destroy(channel_t channel)
+{
+	if (channel == NULL)
+		return -1;
+
+	if (channel->slots == NULL)
+	{
+		if (queue_list_first(&channel->senders) != NULL ||
+				queue_list_first(&channel->receivers) != NULL)
+			return -1;
+
+		pthread_mutex_destroy(&channel->lock);
+		free(channel);
+		return 0;
+	}
+
+	if (atomic_load(&channel->sendWaiting) > 0 ||
+			atomic_load(&channel->recvWaiting) > 0)
+		return -1;
+
+	sem_destroy(channel->sendSem);
+	sem_destroy(channel->recvSem);
+	free(channel->slots);
+	free(channel);
+
+	return 0;
+}
+
+/* Helper function to put an item in the ring, if not full */
+static int ringPush(channel_t channel, void *data)
+{
+	size_t pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+	struct slot *slot;
+	intptr_t diff;
+
+	for (;;)
+	{
+		slot = &channel->slots[pos & channel->mask];
+		diff = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire)
+			- (intptr_t)pos;
+
+		/* Claims the slot if it is free, retries if another sender did */
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&channel->head, &pos,
+					pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		/* The slot still holds the item sent one lap ago */
+		else if (diff < 0)
+			return -1;
+		else
+			pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+	}
+
+	slot->data = data;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	return 0;
+}
+
+/* Helper function to take an item from the ring, if not empty */
+static int ringPop(channel_t channel, void **data)
+{
+	size_t pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+	struct slot *slot;
+	intptr_t diff;
+
+	for (;;)
+	{
+		slot = &channel->slots[pos & channel->mask];
+		diff = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire)
+			- (intptr_t)(pos + 1);
+
+		/* Claims the slot if it is full, retries if another receiver did */
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&channel->tail, &pos,
+					pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		/* The slot has not been sent to yet */
+		else if (diff < 0)
+			return -1;
+		else
+			pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+	}
+
+	*data = slot->data;
+	atomic_store_explicit(&slot->seq, pos + channel->mask + 1,
+			      memory_order_release);
+
+	return 0;
+}
+
+/* Helper function to wake one of the threads waiting on 'sem', if any */
+static void channelWake(atomic_int *waiting, sem_t sem)
+{
+	int count;
+
+	/* Orders the change to the ring before the check for waiters */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	count = atomic_load_explicit(waiting, memory_order_relaxed);
+	while (count > 0)
+	{
+		if (atomic_compare_exchange_weak(waiting, &count, count - 1))
+		{
+			sem_up(sem);
+			return;
+		}
+	}
+}
+
+/* Helper function to count the current thread as waiting on a semaphore */
+static void channelEnter(atomic_int *waiting)
+{
+	atomic_fetch_add(waiting, 1);
+
+	/* Orders the check for waiters before the next look at the ring */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/*
+ * Helper function to stop waiting on 'sem' without blocking. If a thread
+ * already counted the current thread out to wake it, its sem_up() is taken
+ */
+static void channelLeave(atomic_int *waiting, sem_t sem)
+{
+	int count = atomic_load(waiting);
+
+	while (count > 0)
+	{
+		if (atomic_compare_exchange_weak(waiting, &count, count - 1))
+			return;
+	}
+
+	sem_down(sem);
+}
+
+/* Helper function to block on an unbuffered channel until woken up */
+static void partyWait(channel_t channel, struct queue_list *queue,
+		      struct party *self)
+{
+	pthread_cond_init(&self->cond, NULL);
+	queue_list_enqueue(queue, &self->link);
+
+	/* The other side dequeues the thread before waking it up */
+	while (queue == &channel->senders ? self->count > 0 : self->done == 0)
+		pthread_cond_wait(&self->cond, &channel->lock);
+
+	pthread_cond_destroy(&self->cond);
+}
+
+/*
+ * Helper function to send 'count' items through an unbuffered channel, to
+ * the receivers blocked on it first, then to the receivers to come if
+ * 'block' is set. Returns the number of items sent
+ */
+static size_t syncSend(channel_t channel, void **data, size_t count, int block)
+{
+	struct queue_link *link;
+	struct party *receiver, self;
+	size_t sent = 0, n;
+
+	pthread_mutex_lock(&channel->lock);
+
+	/* Hands items straight over to the receivers already waiting */
+	while (sent < count &&
+	       (link = queue_list_dequeue(&channel->receivers)) != NULL)
+	{
+		receiver = queue_entry(link, struct party, link);
+		n = count - sent < receiver->count ? count - sent : receiver->count;
+		memcpy(receiver->data, data + sent, n * sizeof(void*));
+		receiver->done = n;
+		sent += n;
+		pthread_cond_signal(&receiver->cond);
+	}
+
+	/* Waits for receivers to take the other items */
+	if (sent < count && block)
+	{
+		self.data = data + sent;
+		self.count = count - sent;
+		self.done = 0;
+		partyWait(channel, &channel->senders, &self);
+		sent = count;
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+	return sent;
+}
+
+/*
+ * Helper function to receive up to 'count' items from an unbuffered channel,
+ * from the senders blocked on it, or else from the next sender if 'block' is
+ * set. Returns the number of items received
+ */
+static size_t syncRecv(channel_t channel, void **data, size_t count, int block)
+{
+	struct queue_link *link;
+	struct party *sender, self;
+	size_t received = 0, n;
+
+	pthread_mutex_lock(&channel->lock);
+
+	/* Takes items straight from the senders already waiting */
+	while (received < count &&
+	       (link = queue_list_first(&channel->senders)) != NULL)
+	{
+		sender = queue_entry(link, struct party, link);
+		n = count - received < sender->count ? count - received : sender->count;
+		memcpy(data + received, sender->data + sender->done, n * sizeof(void*));
+		sender->done += n;
+		sender->count -= n;
+		received += n;
+
+		/* Wakes up the sender once all its items are taken */
+		if (sender->count == 0)
+		{
+			queue_list_delete(&channel->senders, link);
+			pthread_cond_signal(&sender->cond);
+		}
+	}
+
+	/* Waits for a sender to give some items */
+	if (received == 0 && block)
+	{
+		self.data = data;
+		self.count = count;
+		self.done = 0;
+		partyWait(channel, &channel->receivers, &self);
+		received = self.done;
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+	return received;
+}
+
+/* Sends an item, waiting for a free slot if needed */
+int channel_send(channel_t channel, void *data)
+{
+	if (channel == NULL)
+		return -1;
+
+	if (channel->slots == NULL)
+	{
+		syncSend(channel, &data, 1, 1);
+		return 0;
+	}
+
+	while (ringPush(channel, data) == -1)
+	{
+		channelEnter(&channel->sendWaiting);
+
+		/* The channel may no longer be full since last try */
+		if (ringPush(channel, data) == 0)
+		{
+			channelLeave(&channel->sendWaiting, channel->sendSem);
+			break;
+		}
+
+		sem_down(channel->sendSem);
+	}
+
+	channelWake(&channel->recvWaiting, channel->recvSem);
+	return 0;
+}
+
+/* Receives an item, waiting for one if needed */
+int channel_recv(channel_t channel, void **data)
+{
+	if (channel == NULL || data == NULL)
+		return -1;
+
+	if (channel->slots == NULL)
+	{
+		syncRecv(channel, data, 1, 1);
+		return 0;
+	}
+
+	while (ringPop(channel, data) == -1)
+	{
+		channelEnter(&channel->recvWaiting);
+
+		/* The channel may no longer be empty since last try */
+		if (ringPop(channel, data) == 0)
+		{
+			channelLeave(&channel->recvWaiting, channel->recvSem);
+			break;
+		}
+
+		sem_down(channel->recvSem);
+	}
+
+	channelWake(&channel->sendWaiting, channel->sendSem);
+	return 0;
+}
+
+/* Sends an item if there is a free slot */
+int channel_try_send(channel_t channel, void *data)
+{
+	if (channel == NULL)
+		return -1;
+
+	if (channel->slots == NULL)
+		return syncSend(channel, &data, 1, 0) == 1 ? 0 : -1;
+
+	if (ringPush(channel, data) == -1)
+		return -1;
+
+	channelWake(&channel->recvWaiting, channel->recvSem);
+	return 0;
+}
+
+/* Receives an item if there is one */
+int channel_try_recv(channel_t channel, void **data)
+{
+	if (channel == NULL || data == NULL)
+		return -1;
+
+	if (channel->slots == NULL)
+		return syncRecv(channel, data, 1, 0) == 1 ? 0 : -1;
+
+	if (ringPop(channel, data) == -1)
+		return -1;
+
+	channelWake(&channel->sendWaiting, channel->sendSem);
+	return 0;
+}
+
+/* Sends several items, waiting for free slots or receivers if needed */
+int channel_send_n(channel_t channel, void **data, size_t count)
+{
+	size_t i;
+
+	if (channel == NULL || (data == NULL && count > 0))
+		return -1;
+
+	if (channel->slots == NULL)
+	{
+		syncSend(channel, data, count, 1);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++)
+		channel_send(channel, data[i]);
+
+	return 0;
+}
+
+/* Receives up to 'count' items, waiting for at least one if needed */
+int channel_recv_n(channel_t channel, void **data, size_t count)
+{
+	size_t received = 1;
+
+	if (channel == NULL || data == NULL || count == 0 || count > INT_MAX)
+		return -1;
+
+	if (channel->slots == NULL)
+		return syncRecv(channel, data, count, 1);
+
+	/* Waits for the first item only, then takes the ones already there */
+	channel_recv(channel, &data[0]);
+	while (received < count && ringPop(channel, &data[received]) == 0)
+	{
+		channelWake(&channel->sendWaiting, channel->sendSem);
+		received++;
+	}
+
+	return received;
+}
@@ -0,0 +1,132 @@
+#ifndef _CHANNEL_H
+#define _CHANNEL_H
+
+#include <stddef.h>
+
+/*
+ * channel_t - Channel type
+ *
+ * A channel is a bounded FIFO through which threads send data items to each
+ * other. Any number of threads can send and receive through the same channel.
+ * Sending to a full channel blocks the sender until an item is received, and
+ * receiving from an empty channel blocks the receiver until an item is sent.
+ *
+ * Items are held in a ring of slots which threads claim without any lock, so
+ * that sending and receiving only involve semaphores when a thread has to
+ * wait for the channel not to be full or not to be empty anymore.
+ *
+ * A channel of capacity 0 is unbuffered: it holds no items, and each item is
+ * handed over directly from a sender to a receiver, the first one to arrive
+ * blocking until the other one does (rendezvous).
+ */
+typedef struct channel *channel_t;
+
+/*
+ * channel_create - Create channel
+ * @capacity: Number of items the channel can hold
+ *
+ * Allocate and initialize a channel which can hold at least @capacity items.
+ * The capacity is rounded up to a power of two, and is at least 2, unless
+ * @capacity is 0 which makes an unbuffered channel.
+ *
+ * Return: Pointer to initialized channel. NULL if @capacity is too large, or
+ * in case of failure when allocating the new channel.
+ */
+channel_t channel_create(size_t capacity);
+
+/*
+ * channel_destroy - Deallocate a channel
+ * @channel: Channel to deallocate
+ *
+ * Deallocate channel @channel. Items still in the channel are dropped.
+ *
+ * Return: -1 if @channel is NULL or if threads are still blocked on @channel.
+ * 0 if @channel was successfully destroyed.
+ */
+int channel_destroy(channel_t channel);
+
+/*
+ * channel_send - Send data item
+ * @channel: Channel to send item through
+ * @data: Data item to send
+ *
+ * Send data item @data through channel @channel, blocking the caller thread
+ * while @channel is full, or until a receiver takes @data if @channel is
+ * unbuffered.
+ *
+ * Return: -1 if @channel is NULL. 0 if @data was successfully sent.
+ */
+int channel_send(channel_t channel, void *data);
+
+/*
+ * channel_recv - Receive data item
+ * @channel: Channel to receive item from
+ * @data: Address of data pointer where item is received
+ *
+ * Receive the oldest data item of channel @channel in @data, blocking the
+ * caller thread while @channel is empty.
+ *
+ * Return: -1 if @channel or @data are NULL. 0 if @data was successfully
+ * received.
+ */
+int channel_recv(channel_t channel, void **data);
+
+/*
+ * channel_try_send - Send data item without blocking
+ * @channel: Channel to send item through
+ * @data: Data item to send
+ *
+ * Send data item @data through channel @channel, unless it is full, or unless
+ * no receiver is blocked on it if @channel is unbuffered.
+ *
+ * Return: -1 if @channel is NULL or if @channel is full. 0 if @data was
+ * successfully sent.
+ */
+int channel_try_send(channel_t channel, void *data);
+
+/*
+ * channel_try_recv - Receive data item without blocking
+ * @channel: Channel to receive item from
+ * @data: Address of data pointer where item is received
+ *
+ * Receive the oldest data item of channel @channel in @data, unless it is
+ * empty, or unless no sender is blocked on it if @channel is unbuffered.
+ *
+ * Return: -1 if @channel or @data are NULL or if @channel is empty. 0 if
+ * @data was successfully received.
+ */
+int channel_try_recv(channel_t channel, void **data);
+
+/*
+ * channel_send_n - Send several data items
+ * @channel: Channel to send items through
+ * @data: Array of data items to send
+ * @count: Number of data items to send
+ *
+ * Send the @count data items of @data through channel @channel, in order,
+ * blocking the caller thread while @channel is full. If @channel is
+ * unbuffered, items are copied to the receivers blocked on it, several at a
+ * time, and the caller blocks until receivers have taken all of them.
+ *
+ * Return: -1 if @channel is NULL, or if @data is NULL and @count is not 0. 0
+ * if all items were successfully sent.
+ */
+int channel_send_n(channel_t channel, void **data, size_t count);
+
+/*
+ * channel_recv_n - Receive several data items
+ * @channel: Channel to receive items from
+ * @data: Array where items are received
+ * @count: Maximum number of items to receive
+ *
+ * Receive up to @count of the oldest data items of channel @channel in @data,
+ * blocking the caller thread while @channel is empty. Only the items available
+ * once the first one is received are received: the caller does not wait for
+ * @count items.
+ *
+ * Return: -1 if @channel or @data are NULL, or if @count is 0 or above
+ * INT_MAX. Number of items received otherwise, at least 1.
+ */
+int channel_recv_n(channel_t channel, void **data, size_t count);
+
+#endif /* _CHANNEL_H */
@@ -0,0 +1,48 @@
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Futexes are the primitive semaphores and reader-writer locks sleep on: a
+ * thread sleeps on a word of memory as long as it holds a given value, and is
+ * woken up by another thread which changed it. The kernel only uses the
+ * address of the word to match sleeping and waking threads, so waking up a
+ * word which no longer exists is harmless, at worst a spurious wakeup for the
+ * next futex at that address. Waiters must therefore always check again what
+ * they are waiting for when woken up.
+ */
+
+/*
+ * futex_wait - Sleep on a futex
+ * @word: Futex word
+ * @value: Value @word must still hold for the thread to sleep
+ * @abstime: Absolute deadline, measured against CLOCK_MONOTONIC, or NULL
+ *
+ * Return: 0 if woken up, -1 with errno set to EAGAIN if @word did not hold
+ * @value, to ETIMEDOUT if @abstime passed, or to EINTR if interrupted.
+ */
+static inline int futex_wait(atomic_int *word, int value,
+			     const struct timespec *abstime)
+{
+	/* A bitset wait takes an absolute time, unlike a plain wait */
+	return syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE, value,
+		       abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/*
+ * futex_wake - Wake up threads sleeping on a futex
+ * @word: Futex word
+ * @count: Maximum number of threads to wake up
+ */
+static inline void futex_wake(atomic_int *word, int count)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#endif /* _FUTEX_H */
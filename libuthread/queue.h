@@ -1,6 +1,8 @@
 #ifndef _QUEUE_H
 #define _QUEUE_H
 
+#include <stddef.h>
+
 /*
  * queue_t - Queue type
  *
@@ -112,4 +114,118 @@ int queue_iterate(queue_t queue, queue_func_t func, void *arg, void **data);
  */
 int queue_length(queue_t queue);
 
+/*
+ * struct queue_link - Intrusive queue link
+ *
+ * Unlike queue_t, which allocates a node for each data item it holds, an
+ * intrusive queue links data items through a queue_link embedded in them, so
+ * that enqueueing and dequeueing never allocate memory, and an item can be
+ * deleted in O(1) given its link. A link can only be in one queue at a time.
+ */
+struct queue_link {
+	struct queue_link *prev;
+	struct queue_link *next;
+};
+
+/*
+ * struct queue_list - Intrusive queue
+ *
+ * FIFO of data items linked through their embedded queue_link. All operations
+ * are O(1). An empty queue is all zeros, or initialized with QUEUE_LIST_INIT
+ * or queue_list_init().
+ */
+struct queue_list {
+	struct queue_link *first;
+	struct queue_link *last;
+	size_t length;
+};
+
+#define QUEUE_LIST_INIT { NULL, NULL, 0 }
+
+/*
+ * queue_entry - Data item of a link
+ * @link: Address of queue_link embedded in data item
+ * @type: Type of data item
+ * @member: Name of the queue_link member in @type
+ *
+ * Return: Address of the data item of type @type embedding @link.
+ */
+#define queue_entry(link, type, member) \
+	((type*)((char*)(link) - offsetof(type, member)))
+
+/*
+ * queue_list_init - Initialize an empty intrusive queue
+ * @list: Queue to initialize
+ */
+static inline void queue_list_init(struct queue_list *list)
+{
+	list->first = list->last = NULL;
+	list->length = 0;
+}
+
+/*
+ * queue_list_enqueue - Enqueue data item in intrusive queue
+ * @list: Queue in which to enqueue item
+ * @link: Link embedded in data item to enqueue, not in any queue
+ */
+static inline void queue_list_enqueue(struct queue_list *list,
+				      struct queue_link *link)
+{
+	link->next = NULL;
+	link->prev = list->last;
+	if (list->last != NULL)
+		list->last->next = link;
+	else
+		list->first = link;
+	list->last = link;
+	list->length++;
+}
+
+/*
+ * queue_list_delete - Delete data item from intrusive queue
+ * @list: Queue in which to delete item
+ * @link: Link embedded in data item to delete, which must be in @list
+ */
+static inline void queue_list_delete(struct queue_list *list,
+				     struct queue_link *link)
+{
+	if (link->prev != NULL)
+		link->prev->next = link->next;
+	else
+		list->first = link->next;
+	if (link->next != NULL)
+		link->next->prev = link->prev;
+	else
+		list->last = link->prev;
+	list->length--;
+}
+
+/*
+ * queue_list_first - Oldest data item of intrusive queue
+ * @list: Queue to inspect
+ *
+ * Return: Link embedded in the oldest item of @list, which stays enqueued.
+ * NULL if @list is empty.
+ */
+static inline struct queue_link *queue_list_first(struct queue_list *list)
+{
+	return list->first;
+}
+
+/*
+ * queue_list_dequeue - Dequeue data item from intrusive queue
+ * @list: Queue in which to dequeue item
+ *
+ * Return: Link embedded in the oldest item of @list, which is removed from
+ * @list. NULL if @list is empty.
+ */
+static inline struct queue_link *queue_list_dequeue(struct queue_list *list)
+{
+	struct queue_link *link = list->first;
+
+	if (link != NULL)
+		queue_list_delete(list, link);
+	return link;
+}
+
 #endif /* _QUEUE_H */
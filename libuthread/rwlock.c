@@ -0,0 +1,285 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "futex.h"
+#include "rwlock.h"
+
+/* Size of a cache line, to keep readers of different slots from sharing one */
+#define CACHE_LINE 64
+
+/*
+ * Maximum number of reader counters of a lock, threads are spread over as
+ * many of them as there are processors, up to this
+ */
+#define RWLOCK_SLOTS 32
+
+/* States of the writer of a lock */
+#define WRITER_NONE	0	/* no writer wants the lock */
+#define WRITER_WAITING	1	/* a writer waits for readers, who still enter */
+#define WRITER_ACTIVE	2	/* a writer holds the lock or waits for it,
+				   readers wait */
+
+/*
+ * Reader slot struct
+ * readers:	number of readers of the threads of the slot holding the lock,
+ *		alone in its cache line
+*/
+struct rwslot {
+	_Alignas(CACHE_LINE) atomic_int readers;
+};
+
+/*
+ * Reader-writer lock struct
+ * slots:	reader counters, each thread counts itself in one of them
+ * writer:	state of the writer, which readers sleep on as a futex while
+ *		it is WRITER_ACTIVE
+ * parked:	number of readers sleeping on writer
+ * drain:	bumped by readers leaving while a writer wants the lock, which
+ *		sleeps on it as a futex until no reader is left
+ * writers:	serializes writers
+ * owner:	writer holding the lock, if any
+ * depth:	number of times the writer took the lock again
+ * pref:	RWLOCK_PREFER_READERS or RWLOCK_PREFER_WRITERS
+*/
+struct rwlock {
+	struct rwslot slots[RWLOCK_SLOTS];
+	_Alignas(CACHE_LINE) atomic_int writer;
+	atomic_int parked;
+	atomic_int drain;
+	pthread_mutex_t writers;
+	_Atomic(pthread_t) owner;
+	int depth;
+	enum rwlock_pref pref;
+};
+
+/*
+ * A reader increments the counter of its slot, then checks that no writer is
+ * active: if one is, it decrements the counter again and sleeps until the
+ * writer is done. A writer marks itself active, then checks that all the
+ * counters are 0: if not, it sleeps until the readers holding the lock leave.
+ * Both sides write their own state before reading the other's, with
+ * sequentially consistent atomics, so that at least one of them sees the
+ * other. Readers thus only write to the cache line of their slot, and the
+ * state of the writer is only read, until a writer shows up.
+ *
+ * With RWLOCK_PREFER_READERS, a writer which finds readers lets new readers
+ * in again (WRITER_WAITING) until the lock is free, then tries again. With
+ * RWLOCK_PREFER_WRITERS, it stays active, so that new readers wait behind it.
+*/
+
+/*
+ * Number of reader slots in use, decided once by slotsInit(): there is no
+ * point in more slots than processors, and each costs writers a cache line
+ */
+static int rwSlots;
+static pthread_once_t rwSlotsOnce = PTHREAD_ONCE_INIT;
+
+/* Slot of the current thread, assigned in turn on its first read lock */
+static __thread int rwSlot = -1;
+static atomic_uint rwSlotNext;
+
+/* Decides how many reader slots locks use */
+static void slotsInit(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	rwSlots = cpus < 1 ? 1 : cpus > RWLOCK_SLOTS ? RWLOCK_SLOTS : cpus;
+}
+
+/* Helper function to get the reader slot of the current thread */
+static struct rwslot *readerSlot(rwlock_t lock)
+{
+	if (rwSlot == -1)
+		rwSlot = atomic_fetch_add(&rwSlotNext, 1) % rwSlots;
+
+	return &lock->slots[rwSlot];
+}
+
+/* Helper function to count the readers holding the lock */
+static int readersIn(rwlock_t lock)
+{
+	int i, readers = 0;
+
+	for (i = 0; i < rwSlots; i++)
+		readers += atomic_load(&lock->slots[i].readers);
+
+	return readers;
+}
+
+/*
+ * Helper function to uncount a reader, waking up the writer waiting for
+ * readers to leave if any
+ */
+static void readerLeave(rwlock_t lock, struct rwslot *slot)
+{
+	atomic_fetch_sub(&slot->readers, 1);
+
+	if (atomic_load(&lock->writer) != WRITER_NONE)
+	{
+		atomic_fetch_add(&lock->drain, 1);
+		futex_wake(&lock->drain, 1);
+	}
+}
+
+/* Helper function to wait until no reader holds the lock */
+static void writerDrain(rwlock_t lock)
+{
+	int drain;
+
+	for (;;)
+	{
+		drain = atomic_load(&lock->drain);
+		if (readersIn(lock) == 0)
+			return;
+		futex_wait(&lock->drain, drain, NULL);
+	}
+}
+
+/* Helper function to set the state of the writer, waking up parked readers */
+static void writerSet(rwlock_t lock, int state)
+{
+	atomic_store(&lock->writer, state);
+	if (atomic_load(&lock->parked) > 0)
+		futex_wake(&lock->writer, INT_MAX);
+}
+
+/* Creates an unlocked reader-writer lock */
+rwlock_t rwlock_create(enum rwlock_pref pref)
+{
+	rwlock_t newLock;
+	int i;
+
+	if (pref != RWLOCK_PREFER_READERS && pref != RWLOCK_PREFER_WRITERS)
+		return NULL;
+
+	newLock = aligned_alloc(CACHE_LINE, sizeof(struct rwlock));
+	if (newLock == NULL)
+		return NULL;
+
+	pthread_once(&rwSlotsOnce, slotsInit);
+
+	for (i = 0; i < RWLOCK_SLOTS; i++)
+		atomic_init(&newLock->slots[i].readers, 0);
+	atomic_init(&newLock->writer, WRITER_NONE);
+	atomic_init(&newLock->parked, 0);
+	atomic_init(&newLock->drain, 0);
+	pthread_mutex_init(&newLock->writers, NULL);
+	atomic_init(&newLock->owner, (pthread_t)0);
+	newLock->depth = 0;
+	newLock->pref = pref;
+
+	return newLock;
+}
+
+/* Destroys lock if nobody holds it nor waits for it */
+int rwlock_destroy(rwlock_t lock)
+{
+	if (lock == NULL)
+		return -1;
+	else if (atomic_load(&lock->writer) != WRITER_NONE ||
+			atomic_load(&lock->parked) > 0 || readersIn(lock) > 0)
+		return -1;
+
+	pthread_mutex_destroy(&lock->writers);
+	free(lock);
+
+	return 0;
+}
+
+/* Takes lock for reading, waiting while a writer is active */
+int rwlock_rdlock(rwlock_t lock)
+{
+	struct rwslot *slot;
+
+	if (lock == NULL)
+		return -1;
+
+	slot = readerSlot(lock);
+
+	for (;;)
+	{
+		atomic_fetch_add(&slot->readers, 1);
+		if (atomic_load(&lock->writer) != WRITER_ACTIVE)
+			return 0;
+
+		/* Backs off, and sleeps until the writer is done */
+		readerLeave(lock, slot);
+		atomic_fetch_add(&lock->parked, 1);
+		while (atomic_load(&lock->writer) == WRITER_ACTIVE)
+			futex_wait(&lock->writer, WRITER_ACTIVE, NULL);
+		atomic_fetch_sub(&lock->parked, 1);
+	}
+}
+
+/* Takes lock for writing, waiting for other writers then for readers */
+int rwlock_wrlock(rwlock_t lock)
+{
+	pthread_t self = pthread_self();
+
+	if (lock == NULL)
+		return -1;
+
+	/*
+	 * Takes it again if already holding it, owner can only be the current
+	 * thread if it set it itself, so it needs no ordering
+	 */
+	if (pthread_equal(atomic_load_explicit(&lock->owner,
+			memory_order_relaxed), self))
+	{
+		lock->depth++;
+		return 0;
+	}
+
+	pthread_mutex_lock(&lock->writers);
+
+	for (;;)
+	{
+		atomic_store(&lock->writer, WRITER_ACTIVE);
+		if (readersIn(lock) == 0)
+			break;
+
+		if (lock->pref == RWLOCK_PREFER_WRITERS)
+		{
+			writerDrain(lock);
+			break;
+		}
+
+		/* Lets readers in again while waiting for those holding it to leave */
+		writerSet(lock, WRITER_WAITING);
+		writerDrain(lock);
+	}
+
+	atomic_store_explicit(&lock->owner, self, memory_order_relaxed);
+
+	return 0;
+}
+
+/* Releases lock, held for reading or for writing */
+int rwlock_unlock(rwlock_t lock)
+{
+	if (lock == NULL)
+		return -1;
+
+	if (pthread_equal(atomic_load_explicit(&lock->owner, memory_order_relaxed),
+			pthread_self()))
+	{
+		if (lock->depth > 0)
+		{
+			lock->depth--;
+			return 0;
+		}
+
+		atomic_store_explicit(&lock->owner, (pthread_t)0, memory_order_relaxed);
+		writerSet(lock, WRITER_NONE);
+		pthread_mutex_unlock(&lock->writers);
+		return 0;
+	}
+
+	readerLeave(lock, readerSlot(lock));
+
+	return 0;
+}
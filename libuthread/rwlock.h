@@ -0,0 +1,83 @@
+#ifndef _RWLOCK_H
+#define _RWLOCK_H
+
+/*
+ * rwlock_t - Reader-writer lock type
+ *
+ * A reader-writer lock protects data which many threads read and few threads
+ * modify. Any number of readers can hold the lock at the same time, while a
+ * writer holds it alone. Readers announce themselves in counters spread over
+ * several cache lines, so that readers on different processors do not write
+ * to the same memory, and only a writer has to look at all of them.
+ */
+typedef struct rwlock *rwlock_t;
+
+/*
+ * enum rwlock_pref - Who gets the lock first when readers and writers compete
+ * @RWLOCK_PREFER_READERS: New readers take the lock while a writer waits for
+ *			   the readers holding it, so readers never wait for
+ *			   one another, but a steady flow of them can starve
+ *			   writers.
+ * @RWLOCK_PREFER_WRITERS: New readers wait as soon as a writer wants the lock,
+ *			   so that writers are never starved.
+ */
+enum rwlock_pref {
+	RWLOCK_PREFER_READERS,
+	RWLOCK_PREFER_WRITERS,
+};
+
+/*
+ * rwlock_create - Create reader-writer lock
+ * @pref: Whether readers or writers take the lock first
+ *
+ * Allocate and initialize an unlocked reader-writer lock.
+ *
+ * Return: Pointer to initialized lock. NULL if @pref is invalid or in case of
+ * failure when allocating the new lock.
+ */
+rwlock_t rwlock_create(enum rwlock_pref pref);
+
+/*
+ * rwlock_destroy - Deallocate a reader-writer lock
+ * @lock: Lock to deallocate
+ *
+ * Return: -1 if @lock is NULL or if it is held or waited for. 0 if @lock was
+ * successfully destroyed.
+ */
+int rwlock_destroy(rwlock_t lock);
+
+/*
+ * rwlock_rdlock - Take a reader-writer lock for reading
+ * @lock: Lock to take
+ *
+ * Take lock @lock as one of its readers, blocking the caller thread while a
+ * writer holds it, or, with RWLOCK_PREFER_WRITERS, while a writer waits for
+ * it. A thread holding @lock for reading must not take it for writing.
+ *
+ * Return: -1 if @lock is NULL. 0 if @lock was successfully taken.
+ */
+int rwlock_rdlock(rwlock_t lock);
+
+/*
+ * rwlock_wrlock - Take a reader-writer lock for writing
+ * @lock: Lock to take
+ *
+ * Take lock @lock as its only holder, blocking the caller thread while other
+ * threads hold it. The writer holding @lock may take it again for writing,
+ * and must then release it as many times.
+ *
+ * Return: -1 if @lock is NULL. 0 if @lock was successfully taken.
+ */
+int rwlock_wrlock(rwlock_t lock);
+
+/*
+ * rwlock_unlock - Release a reader-writer lock
+ * @lock: Lock to release
+ *
+ * Release lock @lock, held by the caller thread for reading or for writing.
+ *
+ * Return: -1 if @lock is NULL. 0 if @lock was successfully released.
+ */
+int rwlock_unlock(rwlock_t lock);
+
+#endif /* _RWLOCK_H */
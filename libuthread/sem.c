@@ -1,130 +1,864 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "futex.h"
 #include "queue.h"
 #include "sem.h"
-#include "thread.h"
+
+/*
+ * Waiter struct, on the stack of a thread blocked in sem_down(), so that
+ * blocking and waking never allocate memory
+ * link:	 link in the intrusive queue of waiters for resource
+ * need:	 number of resources the thread still waits for, which it
+ *		 sleeps on as a futex until it drops to 0
+*/
+struct waiter {
+	struct queue_link link;
+	atomic_int need;
+};
+
+/*
+ * Maximum number of waiters woken up after a critical section, any others
+ * being woken up within it
+ */
+#define SEM_WAKE_BATCH	16
+
+/*
+ * Wake list struct, on the stack of a thread giving resources, holding the
+ * waiters it gave all they need in its critical section
+ * count:	 number of waiters to wake up
+ * words:	 futex words of those waiters
+*/
+struct wakelist {
+	int count;
+	atomic_int *words[SEM_WAKE_BATCH];
+};
+
+/*
+ * Bounds of the spinning phase of sem_down(), in pause instructions: a
+ * thread spins for up to twice the recent spinning of the semaphore plus
+ * SEM_SPIN_MIN, at most SEM_SPIN_MAX, pausing up to SEM_SPIN_BACKOFF times
+ * between checks of the count
+ */
+#define SEM_SPIN_MIN		64
+#define SEM_SPIN_MAX		8192
+#define SEM_SPIN_BACKOFF	64
+
+/* Whether to spin at all, decided once by semSpinInit() */
+static int semSpinning;
+static pthread_once_t semSpinOnce = PTHREAD_ONCE_INIT;
+
+#ifdef SEM_STATS
+/*
+ * Stats struct, compiled in with SEM_STATS only
+ * acquisitions: number of times resources were taken, counted atomically
+ * 		 as the fast path does not take the lock
+ * others:	 see struct sem_stats, protected by the lock of the semaphore
+ * link:	 link in the list of all semaphores
+ * name:	 name the semaphore is dumped under, if any
+*/
+struct stats {
+	atomic_ulong acquisitions;
+	unsigned long contended;
+	unsigned long long wait_ns;
+	unsigned long long max_wait_ns;
+	unsigned int max_depth;
+	unsigned long wakeups;
+	atomic_ulong spun;
+	struct queue_link link;
+	char name[SEM_NAME_MAX];
+};
+
+/* List of all semaphores, for sem_stats_dump() */
+static struct queue_list semList = QUEUE_LIST_INIT;
+static pthread_mutex_t semListLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* 
  * Semaphore struct
- * blockedQueue: queue of threads waiting for resource
- * count: 	 number of available resources
+ * lock:	 protects the waiters and wakeups
+ * waiters:	 intrusive queue of waiters for resource
+ * count: 	 number of available resources, or minus the number of
+ *		 resources waiting threads still need if negative
+ * wakeups:	 resources given up to waiting threads which are not in
+ *		 the queue of waiters yet, or minus the number of resources
+ *		 taken by timed out threads ahead of the sem_up() giving them
+ * mode:	 SEM_HANDOFF or SEM_BARGING
+ * sleepers:	 number of threads between deciding to wait and taking a
+ *		 resource, with SEM_BARGING only
+ * spin:	 moving average of the pauses spinning threads took to get
+ *		 a resource, which bounds the next spinning phase
+ * stats:	 usage statistics, with SEM_STATS only
 */
 struct semaphore {
-	queue_t blockedQueue;
-	int count;
+	pthread_mutex_t lock;
+	struct queue_list waiters;
+	atomic_int count;
+	int wakeups;
+	enum sem_mode mode;
+	atomic_int sleepers;
+	atomic_int spin;
+#ifdef SEM_STATS
+	struct stats stats;
+#endif
 };
 
 /*
  * During any critical sections (where operations need to
- * complete atomically) the enter() and exit() critical 
- * section commands are called. This ensures that these
- * sections will complete without interruption
+ * complete atomically) the lock of the semaphore is taken,
+ * so that operations on unrelated semaphores never wait
+ * for each other
+ *
+ * sem_down() and sem_up() only take it when a thread
+ * has to wait for a resource or be given one: as long as
+ * the count does not go negative, they simply decrement or
+ * increment it atomically, by any number of resources
+ *
+ * A thread taking several resources keeps the ones that
+ * are available and waits for the rest, which are given to
+ * waiting threads in order, so that batches are neither
+ * starved by single resources nor deadlock each other
+ *
+ * Just like thread_block() exits the critical section of
+ * the thread library before going to sleep and re-enters it
+ * upon wake-up, a waiting thread releases the lock of the
+ * semaphore while it sleeps on a futex of its own, the
+ * number of resources it still needs
+ *
+ * The above is the hand-off mode: sem_up() gives resources to
+ * waiting threads directly, so a thread arriving meanwhile
+ * cannot take them. In barging mode, the count never goes
+ * negative: sem_up() puts the resource back in the count and
+ * only wakes the oldest waiting thread, which takes it like
+ * any other thread would, if nobody took it first, and waits
+ * again otherwise. A running thread can thus take a resource
+ * right away instead of waiting for a sleeping one to run,
+ * which gives more throughput but no fairness
+ *
+ * A resource is often released a moment after a thread finds
+ * none, when threads pass it back and forth, so sem_down()
+ * first spins for a while before waiting, as long as no other
+ * thread already waits. Each semaphore keeps a moving average
+ * of how long spinning took to succeed, and spins for up to
+ * twice as long, so that semaphores whose resources come back
+ * quickly are spun on more, and the others barely at all.
+ * Spinning is useless on a single processor, as the thread
+ * releasing the resource cannot run meanwhile, so it is then
+ * disabled, as well as when SEM_NO_SPIN is set
+ *
+ * Waiting threads are only woken up once the lock of the
+ * semaphore is released: woken up while it is still held,
+ * they would run only to wait for it again. The futexes of
+ * waiters given all they need are gathered in a wake list
+ * in the critical section, and woken up together after it
+ * (semWake()). A waiter can then see that it was given its
+ * resources and return before being woken up, so the wake
+ * list only holds the addresses of the futexes, which the
+ * kernel never dereferences: a late wakeup is at worst
+ * spurious for the next futex at that address
+ *
+ * Statistics are only compiled in when SEM_STATS is defined
+ * (make S=1): otherwise the helpers below which keep them are
+ * empty and disappear from the fast path altogether
 */
 
+#ifdef SEM_STATS
+/* Helper function to get the current time, to time waits */
+static unsigned long long statsNow(void)
+{
+	struct timespec ts;
 
-/* Initializes and allocates a semaphore of count 'count'*/
-sem_t sem_create(size_t count)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Helper function to count resources taken without waiting */
+static void statsAcquired(sem_t sem)
+{
+	atomic_fetch_add_explicit(&sem->stats.acquisitions, 1,
+			memory_order_relaxed);
+}
+
+/*
+ * Helper function to count resources taken after waiting since 'start',
+ * called with the lock of the semaphore held
+ */
+static void statsWaited(sem_t sem, unsigned long long start)
 {
-	enter_critical_section();
+	unsigned long long wait = statsNow() - start;
 
-	sem_t newSem = malloc(sizeof(sem_t));
-	newSem->count = count;
-	newSem->blockedQueue = queue_create();
+	statsAcquired(sem);
+	sem->stats.contended++;
+	sem->stats.wait_ns += wait;
+	if (wait > sem->stats.max_wait_ns)
+		sem->stats.max_wait_ns = wait;
+}
+
+/* Helper function to record the depth of the queue of waiters */
+static void statsQueued(sem_t sem)
+{
+	if (sem->waiters.length > sem->stats.max_depth)
+		sem->stats.max_depth = sem->waiters.length;
+}
 
-	exit_critical_section();	
+/* Helper function to count the waiting threads woken up */
+static void statsWoken(sem_t sem)
+{
+	sem->stats.wakeups++;
+}
+
+/* Helper function to count resources taken while spinning */
+static void statsSpun(sem_t sem)
+{
+	atomic_fetch_add_explicit(&sem->stats.spun, 1, memory_order_relaxed);
+}
+#else
+static inline unsigned long long statsNow(void) { return 0; }
+static inline void statsAcquired(sem_t sem) { (void)sem; }
+static inline void statsWaited(sem_t sem, unsigned long long start)
+{
+	(void)sem;
+	(void)start;
+}
+static inline void statsQueued(sem_t sem) { (void)sem; }
+static inline void statsWoken(sem_t sem) { (void)sem; }
+static inline void statsSpun(sem_t sem) { (void)sem; }
+#endif
+
+/* Decides whether threads spin before waiting */
+static void semSpinInit(void)
+{
+	semSpinning = sysconf(_SC_NPROCESSORS_ONLN) > 1 &&
+		getenv("SEM_NO_SPIN") == NULL;
+}
+
+/* Helper function to let the other hardware thread of the core run */
+static inline void semPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+
+/* Initializes and allocates a semaphore of count 'count' and mode 'mode' */
+sem_t sem_create_mode(size_t count, enum sem_mode mode)
+{
+	sem_t newSem;
+
+	if (mode != SEM_HANDOFF && mode != SEM_BARGING)
+		return NULL;
+
+	newSem = malloc(sizeof(struct semaphore));
+	if (newSem == NULL)
+		return NULL;
+
+	queue_list_init(&newSem->waiters);
+	pthread_mutex_init(&newSem->lock, NULL);
+	atomic_init(&newSem->count, count);
+	newSem->wakeups = 0;
+	newSem->mode = mode;
+	atomic_init(&newSem->sleepers, 0);
+	atomic_init(&newSem->spin, 0);
+	pthread_once(&semSpinOnce, semSpinInit);
+
+#ifdef SEM_STATS
+	memset(&newSem->stats, 0, sizeof(newSem->stats));
+	atomic_init(&newSem->stats.acquisitions, 0);
+	pthread_mutex_lock(&semListLock);
+	queue_list_enqueue(&semList, &newSem->stats.link);
+	pthread_mutex_unlock(&semListLock);
+#endif
 
 	return newSem;
 }
 
+/* Initializes and allocates a semaphore of count 'count'*/
+sem_t sem_create(size_t count)
+{
+	return sem_create_mode(count, SEM_HANDOFF);
+}
+
 /* Destroys semaphore if possible */
 int sem_destroy(sem_t sem)
 {
 	/* check if sem exists */
 	if (sem == NULL)
 		return -1;
-	/* Check if blocked queue is not empty */
-	else if (queue_destroy(sem->blockedQueue) == -1)
+	/* Check if threads are waiting for a resource */
+	else if (atomic_load(&sem->count) < 0)
+		return -1;
+	/* Check if threads are still in the queue of waiters */
+	else if (queue_list_first(&sem->waiters) != NULL ||
+			atomic_load(&sem->sleepers) > 0)
 		return -1;	
 
+#ifdef SEM_STATS
+	pthread_mutex_lock(&semListLock);
+	queue_list_delete(&semList, &sem->stats.link);
+	pthread_mutex_unlock(&semListLock);
+#endif
+
+	pthread_mutex_destroy(&sem->lock);
 	free(sem);
 
 	return 0;
 }
 
+/*
+ * Helper function to sleep until given more resources or until 'abstime' if
+ * any, called with the lock of the semaphore held, which is released meanwhile
+ */
+static int waiterSleep(sem_t sem, struct waiter *self,
+		const struct timespec *abstime)
+{
+	int need = atomic_load(&self->need), ret = 0;
+
+	pthread_mutex_unlock(&sem->lock);
+	if (futex_wait(&self->need, need, abstime) == -1 && errno == ETIMEDOUT)
+		ret = -1;
+	pthread_mutex_lock(&sem->lock);
+
+	return ret;
+}
+
+/*
+ * Helper function to add a waiter given all it needs to the wake list
+ * 'wake', called with the lock of the semaphore held
+ */
+static void waiterWake(struct waiter *waiter, struct wakelist *wake)
+{
+	atomic_store(&waiter->need, 0);
+	if (wake->count < SEM_WAKE_BATCH)
+		wake->words[wake->count++] = &waiter->need;
+	else
+		futex_wake(&waiter->need, 1);
+}
+
+/*
+ * Helper function to wake up the waiters of the wake list 'wake', after the
+ * critical section which filled it
+ */
+static void semWake(struct wakelist *wake)
+{
+	int i;
+
+	for (i = 0; i < wake->count; i++)
+		futex_wake(wake->words[i], 1);
+}
+
+/*
+ * Helper function to give 'count' resources to waiting threads, in order,
+ * called with the lock of the semaphore held, moving those given all they
+ * need to the wake list 'wake'. Resources left over belong to
+ * threads which are not in the queue of waiters yet
+ */
+static void semGive(sem_t sem, int count, struct wakelist *wake)
+{
+	struct queue_link *link;
+	struct waiter *waiter;
+	int given;
+
+	/*
+	 * Resources already taken by timed out threads ahead of this call
+	 * belong to them, not to the threads queued since
+	 */
+	if (sem->wakeups < 0)
+	{
+		given = -sem->wakeups < count ? -sem->wakeups : count;
+		sem->wakeups += given;
+		count -= given;
+	}
+
+	while (count > 0 && (link = queue_list_first(&sem->waiters)) != NULL)
+	{
+		waiter = queue_entry(link, struct waiter, link);
+		given = waiter->need < count ? waiter->need : count;
+		waiter->need -= given;
+		count -= given;
+
+		/* Wakes up the oldest waiting thread once it has all it needs */
+		if (waiter->need == 0)
+		{
+			queue_list_delete(&sem->waiters, link);
+			waiterWake(waiter, wake);
+			statsWoken(sem);
+		}
+	}
+
+	sem->wakeups += count;
+}
+
+/*
+ * Helper function to take 'count' resources if they are all available,
+ * without ever waiting
+ */
+static int semTake(sem_t sem, int count)
+{
+	int avail = atomic_load_explicit(&sem->count, memory_order_relaxed);
+
+	while (avail >= count)
+	{
+		if (atomic_compare_exchange_weak_explicit(&sem->count, &avail,
+				avail - count, memory_order_acquire, memory_order_relaxed))
+		{
+			statsAcquired(sem);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Helper function to spin for a while, with exponential backoff, until
+ * 'count' resources are available and taken, before resorting to wait
+ */
+static int semSpin(sem_t sem, int count)
+{
+	int spin = atomic_load_explicit(&sem->spin, memory_order_relaxed);
+	int limit = 2 * spin + SEM_SPIN_MIN;
+	int spins = 0, backoff = 1, i;
+
+	if (limit > SEM_SPIN_MAX)
+		limit = SEM_SPIN_MAX;
+
+	while (spins < limit)
+	{
+		for (i = 0; i < backoff; i++)
+			semPause();
+		spins += backoff;
+		if (backoff < SEM_SPIN_BACKOFF)
+			backoff <<= 1;
+
+		/* Only tries to take resources once they show up */
+		if (atomic_load_explicit(&sem->count, memory_order_relaxed) >= count &&
+				semTake(sem, count) == 0)
+		{
+			atomic_store_explicit(&sem->spin, spin + (spins - spin) / 8,
+					memory_order_relaxed);
+			statsSpun(sem);
+			return 0;
+		}
+	}
+
+	/* Spins less on semaphores whose resources do not come back quickly */
+	atomic_store_explicit(&sem->spin, spin - spin / 4 - (spin > 0),
+			memory_order_relaxed);
+	return -1;
+}
+
+/*
+ * Helper function to wake up, in barging mode, the waiting threads which the
+ * available resources are enough for, in order, called with the lock of the
+ * semaphore held. Waiters needing more than what is left are skipped, so that
+ * a waiter taking several resources does not hold up the others.
+ */
+static void bargeWake(sem_t sem, struct wakelist *wake)
+{
+	int avail = atomic_load(&sem->count);
+	struct queue_link *link, *next;
+	struct waiter *waiter;
+
+	for (link = queue_list_first(&sem->waiters); link != NULL && avail > 0;
+			link = next)
+	{
+		next = link->next;
+		waiter = queue_entry(link, struct waiter, link);
+		if (waiter->need > avail)
+			continue;
+
+		avail -= waiter->need;
+		queue_list_delete(&sem->waiters, link);
+		waiterWake(waiter, wake);
+		statsWoken(sem);
+	}
+}
+
+/*
+ * Helper function to give 'count' resources back in barging mode, waking
+ * waiting threads to compete for them
+ */
+static void bargeRelease(sem_t sem, int count)
+{
+	struct wakelist wake = { 0 };
+
+	atomic_fetch_add(&sem->count, count);
+
+	/* Orders the increment before the check for sleepers */
+	if (atomic_load(&sem->sleepers) == 0)
+		return;
+
+	pthread_mutex_lock(&sem->lock);
+	bargeWake(sem, &wake);
+	pthread_mutex_unlock(&sem->lock);
+
+	semWake(&wake);
+}
+
+/*
+ * Helper function to take 'count' resources in barging mode, waiting until
+ * absolute time 'abstime' if any, or indefinitely otherwise
+ */
+static int bargeDown(sem_t sem, int count, const struct timespec *abstime)
+{
+	struct wakelist wake = { 0 };
+	struct waiter self;
+	unsigned long long start;
+	int taken, ret = 0;
+
+	if (semTake(sem, count) == 0)
+		return 0;
+
+	start = statsNow();
+
+	/*
+	 * Counts itself as a sleeper before trying again under the lock, so that
+	 * a sem_up() either lets it take the resource or finds it in the queue
+	 */
+	atomic_fetch_add(&sem->sleepers, 1);
+	pthread_mutex_lock(&sem->lock);
+
+	/* Tries again each time it is woken up, as a running thread may be first */
+	while (!(taken = semTake(sem, count) == 0) && ret == 0)
+	{
+		/*
+		 * Passes on resources it may have been woken up for, to waiters
+		 * which need fewer of them
+		 */
+		bargeWake(sem, &wake);
+		semWake(&wake);
+		wake.count = 0;
+
+		self.need = count;
+		queue_list_enqueue(&sem->waiters, &self.link);
+		statsQueued(sem);
+
+		while (self.need > 0 && ret == 0)
+			ret = waiterSleep(sem, &self, abstime);
+
+		/* Leaves the queue if timed out before being woken up */
+		if (self.need > 0)
+			queue_list_delete(&sem->waiters, &self.link);
+	}
+
+	/* Passes on resources it was woken up for right before timing out */
+	if (!taken)
+		bargeWake(sem, &wake);
+
+	atomic_fetch_sub(&sem->sleepers, 1);
+	if (taken)
+		statsWaited(sem, start);
+	pthread_mutex_unlock(&sem->lock);
+	semWake(&wake);
+
+	return taken ? 0 : -1;
+}
+
+/*
+ * Helper function to give 'count' resources back, from any thread
+ */
+static void semRelease(sem_t sem, int count)
+{
+	struct wakelist wake = { 0 };
+	int prev;
+
+	if (sem->mode == SEM_BARGING)
+	{
+		bargeRelease(sem, count);
+		return;
+	}
+
+	prev = atomic_fetch_add_explicit(&sem->count, count,
+			memory_order_release);
+
+	/* Gives the resources owed to waiting threads, if any */
+	if (prev < 0)
+	{
+		pthread_mutex_lock(&sem->lock);
+		semGive(sem, -prev < count ? -prev : count, &wake);
+		pthread_mutex_unlock(&sem->lock);
+		semWake(&wake);
+	}
+}
+
+/*
+ * Helper function to stop waiting for 'need' resources after a timeout,
+ * called with the lock of the semaphore held once the waiter has left the
+ * queue of waiters. Returns how many of them could be given back, the others
+ * having already been given up to the waiter by sem_up() calls which have yet
+ * to take the lock
+ */
+static int semCancel(sem_t sem, int need)
+{
+	int count = atomic_load(&sem->count);
+	int back = 0;
+
+	/*
+	 * While the count is negative, more resources are needed than sem_up()
+	 * calls are giving, so part of the need can simply be withdrawn
+	 */
+	while (count < 0)
+	{
+		back = -count < need ? -count : need;
+		if (atomic_compare_exchange_weak(&sem->count, &count, count + back))
+		{
+			need -= back;
+			break;
+		}
+	}
+
+	/*
+	 * Otherwise those sem_up() calls will find no waiter and record
+	 * wakeups, which are taken in advance
+	 */
+	sem->wakeups -= need;
+	return back;
+}
+
+/*
+ * Helper function to take 'count' resources, waiting until absolute time
+ * 'abstime' if any, or indefinitely otherwise
+ */
+static int semDown(sem_t sem, int count, const struct timespec *abstime)
+{
+	struct waiter self;
+	int prev, back, ret = 0;
+	unsigned long long start;
+
+	/*
+	 * Spins if no resource is available but no thread waits yet either, as
+	 * resources go to waiting threads first otherwise
+	 */
+	if (semSpinning &&
+			atomic_load_explicit(&sem->count, memory_order_relaxed) == 0 &&
+			atomic_load_explicit(&sem->sleepers, memory_order_relaxed) == 0 &&
+			semSpin(sem, count) == 0)
+		return 0;
+
+	if (sem->mode == SEM_BARGING)
+		return bargeDown(sem, count, abstime);
+
+	/* Takes resources right away if enough are available */
+	prev = atomic_fetch_sub_explicit(&sem->count, count, memory_order_acquire);
+	if (prev >= count)
+	{
+		statsAcquired(sem);
+		return 0;
+	}
+
+	/* Keeps the resources that were available, and waits for the others */
+	self.need = prev > 0 ? count - prev : count;
+	start = statsNow();
+
+	pthread_mutex_lock(&sem->lock);
+
+	/*
+	 * Takes the resources that were given up between
+	 * the decrement and the critical section
+	 */
+	if (sem->wakeups > 0)
+	{
+		back = sem->wakeups < self.need ? sem->wakeups : self.need;
+		sem->wakeups -= back;
+		self.need -= back;
+	}
+
+	if (self.need > 0)
+	{
+		queue_list_enqueue(&sem->waiters, &self.link);
+		statsQueued(sem);
+
+		while (self.need > 0 && ret == 0)
+			ret = waiterSleep(sem, &self, abstime);
+
+		/* Leaves the queue if timed out before being given all resources */
+		if (self.need > 0)
+		{
+			queue_list_delete(&sem->waiters, &self.link);
+			back = semCancel(sem, self.need);
+
+			/* Gives back the resources it was given */
+			if (back > 0)
+			{
+				pthread_mutex_unlock(&sem->lock);
+				if (count > back)
+					semRelease(sem, count - back);
+				return -1;
+			}
+		}
+	}
+
+	statsWaited(sem, start);
+	pthread_mutex_unlock(&sem->lock);
+	return 0;
+}
+
 /* Gives resource to calling thread if possible, if not, blocks it */
 int sem_down(sem_t sem)
 {
-	pthread_t tid;
-
 	/* Check if sem exists */
 	if (sem == NULL)
 		return -1;
 
-	enter_critical_section();
-	
-	/* Checks if resource available */
-	if (sem->count == 0)
-	{
-		tid = pthread_self();
-		queue_enqueue(sem->blockedQueue, (void*)tid);
-		thread_block();
-	}
+	return semDown(sem, 1, NULL);
+}
 
-	/* Gives resource to waiting thread */
-	sem->count--;
+/* Gives resources to calling thread if possible, if not, blocks it */
+int sem_down_n(sem_t sem, size_t count)
+{
+	/* Check if sem exists and count is representable */
+	if (sem == NULL || count > INT_MAX)
+		return -1;
 
-	exit_critical_section();
-	return 0;
+	if (count == 0)
+		return 0;
+
+	return semDown(sem, count, NULL);
 }
 
-/* Gives up resource to next waiting thread if any */
-int sem_up(sem_t sem)
+/* Gives resource to calling thread if possible, blocking it until a deadline */
+int sem_timeddown(sem_t sem, const struct timespec *abstime)
 {
-	pthread_t tid;
+	/* Check if sem and deadline exist */
+	if (sem == NULL || abstime == NULL)
+		return -1;
 
+	return semDown(sem, 1, abstime);
+}
+
+/* Gives resource to calling thread if possible, without ever blocking it */
+int sem_trydown(sem_t sem)
+{
 	/* Check if sem exists */
 	if (sem == NULL)
 		return -1;
 
-	enter_critical_section();
+	/* Only takes resource if one is available, never queues as a waiter */
+	return semTake(sem, 1);
+}
 
-	/* Checks if there is a thread waiting for resource */
-	if (queue_length(sem->blockedQueue) != 0)
-	{
-		queue_dequeue(sem->blockedQueue, (void**)&tid);
-		thread_unblock(tid);
-	}
+/* Gives up resource to next waiting thread if any */
+int sem_up(sem_t sem)
+{
+	/* Check if sem exists */
+	if (sem == NULL)
+		return -1;
 
-	/* Releases resource from current thread */
-	sem->count++;
+	semRelease(sem, 1);
+	return 0;
+}
 
-	exit_critical_section();
+/* Gives up resources to next waiting threads if any */
+int sem_up_n(sem_t sem, size_t count)
+{
+	/* Check if sem exists and count is representable */
+	if (sem == NULL || count > INT_MAX)
+		return -1;
+
+	if (count > 0)
+		semRelease(sem, count);
 	return 0;
 }
 
 /* Returns resource count of a semaphore */
 int sem_getvalue(sem_t sem, int *sval)
 {
-	int numInQueue = 0;
-
 	if (sem == NULL || sval == NULL)
 		return -1;
 
-	enter_critical_section();
+	/*
+	 * If no available resources, the count already is minus the
+	 * number of blocked threads
+	 */
+	*sval = atomic_load(&sem->count);
 
-	if (sem->count > 0)
-		*sval = sem->count;
+	/* In barging mode, the count stays at 0 while threads wait */
+	if (sem->mode == SEM_BARGING && *sval == 0)
+		*sval = -atomic_load(&sem->sleepers);
 
-	/* If no available resources, sets sval to the number of blocked threads */
-	else if (sem->count == 0)
-	{
-		numInQueue = queue_length(sem->blockedQueue);
-		*sval = -numInQueue;
-	}
+	return 0;
+}
+
+/* Names a semaphore for sem_stats_dump() */
+int sem_set_name(sem_t sem, const char *name)
+{
+	if (sem == NULL || name == NULL)
+		return -1;
+
+#ifdef SEM_STATS
+	pthread_mutex_lock(&sem->lock);
+	strncpy(sem->stats.name, name, SEM_NAME_MAX - 1);
+	sem->stats.name[SEM_NAME_MAX - 1] = '\0';
+	pthread_mutex_unlock(&sem->lock);
+#endif
+
+	return 0;
+}
+
+/* Returns usage statistics of a semaphore, if compiled in */
+int sem_stats(sem_t sem, struct sem_stats *stats)
+{
+	if (sem == NULL || stats == NULL)
+		return -1;
 
-	exit_critical_section();
+#ifdef SEM_STATS
+	pthread_mutex_lock(&sem->lock);
+	stats->acquisitions = atomic_load(&sem->stats.acquisitions);
+	stats->contended = sem->stats.contended;
+	stats->wait_ns = sem->stats.wait_ns;
+	stats->max_wait_ns = sem->stats.max_wait_ns;
+	stats->max_depth = sem->stats.max_depth;
+	stats->wakeups = sem->stats.wakeups;
+	stats->spun = atomic_load(&sem->stats.spun);
+	pthread_mutex_unlock(&sem->lock);
 
 	return 0;
+#else
+	return -1;
+#endif
 }
 
+/* Prints usage statistics of all named semaphores, if compiled in */
+int sem_stats_dump(FILE *stream)
+{
+#ifdef SEM_STATS
+	struct queue_link *link;
+	struct semaphore *sem;
+	struct sem_stats stats;
+
+	if (stream == NULL)
+		return -1;
+
+	pthread_mutex_lock(&semListLock);
+	for (link = semList.first; link != NULL; link = link->next)
+	{
+		sem = queue_entry(link, struct semaphore, stats.link);
+		if (sem->stats.name[0] == '\0')
+			continue;
+
+		sem_stats(sem, &stats);
+		fprintf(stream, "%s: acquisitions=%lu contended=%lu wait_ns=%llu "
+			"max_wait_ns=%llu max_depth=%u wakeups=%lu spun=%lu\n",
+			sem->stats.name, stats.acquisitions, stats.contended,
+			stats.wait_ns, stats.max_wait_ns, stats.max_depth,
+			stats.wakeups, stats.spun);
+	}
+	pthread_mutex_unlock(&semListLock);
+
+	return 0;
+#else
+	(void)stream;
+	return -1;
+#endif
+}
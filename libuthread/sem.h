@@ -2,7 +2,9 @@
 #define _SEMAPHORE_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
+#include <time.h>
 
 /*
  * sem_t - Semaphore type
@@ -26,6 +28,37 @@ typedef struct semaphore *sem_t;
  */
 sem_t sem_create(size_t count);
 
+/*
+ * enum sem_mode - How a semaphore gives resources to waiting threads
+ * @SEM_HANDOFF: sem_up() gives the resource directly to the oldest waiting
+ *		 thread, which no other thread can take it from. Resources are
+ *		 taken in order, but each hand-over waits for the woken thread
+ *		 to run.
+ * @SEM_BARGING: sem_up() makes the resource available and wakes the oldest
+ *		 waiting thread, but a running thread may take the resource
+ *		 first, in which case the woken thread waits again. This keeps
+ *		 the resource busy under contention, at the cost of fairness.
+ *		 A waiting thread needing more resources than are available
+ *		 lets the ones behind it which need fewer go first.
+ */
+enum sem_mode {
+	SEM_HANDOFF,
+	SEM_BARGING,
+};
+
+/*
+ * sem_create_mode - Create semaphore with a given mode
+ * @count: Semaphore count
+ * @mode: How resources are given to waiting threads
+ *
+ * Allocate and initialize a semaphore of internal count @count, like
+ * sem_create() which creates a semaphore of mode SEM_HANDOFF.
+ *
+ * Return: Pointer to initialized semaphore. NULL if @mode is invalid or in case
+ * of failure when allocating the new semaphore.
+ */
+sem_t sem_create_mode(size_t count, enum sem_mode mode);
+
 /*
  * sem_destroy - Deallocate a semaphore
  * @sem: Semaphore to deallocate
@@ -44,12 +77,39 @@ int sem_destroy(sem_t sem);
  * Take a resource from semaphore @sem.
  *
  * Taking an unavailable semaphore will cause the caller thread to be blocked
- * until the semaphore becomes available.
+ * until the semaphore becomes available. On multiprocessors, the caller thread
+ * first spins for a short while, adapted to how long resources of @sem took to
+ * come back recently, unless the SEM_NO_SPIN environment variable is set.
  *
  * Return: -1 if @sem is NULL. 0 if semaphore was successfully taken.
  */
 int sem_down(sem_t sem);
 
+/*
+ * sem_trydown - Take a semaphore without blocking
+ * @sem: Semaphore to take
+ *
+ * Take a resource from semaphore @sem if one is available right away.
+ *
+ * Return: -1 if @sem is NULL or if no resource is available. 0 if semaphore
+ * was successfully taken.
+ */
+int sem_trydown(sem_t sem);
+
+/*
+ * sem_timeddown - Take a semaphore with a deadline
+ * @sem: Semaphore to take
+ * @abstime: Absolute deadline, measured against CLOCK_MONOTONIC
+ *
+ * Take a resource from semaphore @sem, like sem_down(), but give up if it is
+ * still unavailable at time @abstime. A thread which gives up leaves the
+ * waiting list without consuming a resource.
+ *
+ * Return: -1 if @sem or @abstime are NULL, or if the deadline passed before a
+ * resource became available. 0 if semaphore was successfully taken.
+ */
+int sem_timeddown(sem_t sem, const struct timespec *abstime);
+
 /*
  * sem_up - Release a semaphore
  * @sem: Semaphore to release
@@ -64,6 +124,37 @@ int sem_down(sem_t sem);
  */
 int sem_up(sem_t sem);
 
+/*
+ * sem_down_n - Take several resources of a semaphore at once
+ * @sem: Semaphore to take
+ * @count: Number of resources to take
+ *
+ * Take @count resources from semaphore @sem, as a single operation.
+ *
+ * If fewer than @count resources are available, the caller thread keeps them
+ * and is blocked until it is given the others. Waiting threads are given
+ * resources in order, so that taking many resources cannot be starved by
+ * threads taking fewer.
+ *
+ * Return: -1 if @sem is NULL or if @count is greater than INT_MAX. 0 if the
+ * resources were successfully taken.
+ */
+int sem_down_n(sem_t sem, size_t count);
+
+/*
+ * sem_up_n - Release several resources of a semaphore at once
+ * @sem: Semaphore to release
+ * @count: Number of resources to release
+ *
+ * Release @count resources to semaphore @sem, as a single operation which
+ * unblocks as many of the waiting threads as these resources satisfy, oldest
+ * first.
+ *
+ * Return: -1 if @sem is NULL or if @count is greater than INT_MAX. 0 if the
+ * resources were successfully released.
+ */
+int sem_up_n(sem_t sem, size_t count);
+
 /*
  * sem_getvalue - Inspect semaphore's internal state
  * @sem: Semaphore to inspect
@@ -74,11 +165,77 @@ int sem_up(sem_t sem);
  *
  * If semaphore @sems's internal count is equal to 0, assign a negative number
  * whose absolute value is the count of the number of threads currently blocked
- * in sem_down().
+ * in sem_down(), or of the resources they are still waiting for when taking
+ * several at once.
  *
  * Return: -1 if @sem or @sval are NULL. 0 if semaphore was successfully
  * inspected.
  */
 int sem_getvalue(sem_t sem, int *sval);
 
+/* Maximum length of a semaphore name, including the terminating null byte */
+#define SEM_NAME_MAX 32
+
+/*
+ * struct sem_stats - Semaphore usage statistics
+ * @acquisitions: Number of successful sem_down(), sem_down_n(),
+ *		  sem_timeddown() and sem_trydown() calls
+ * @contended: Number of those acquisitions which had to wait
+ * @wait_ns: Total time spent waiting by contended acquisitions, in nanoseconds
+ * @max_wait_ns: Longest time spent waiting by a contended acquisition
+ * @max_depth: Largest number of threads waiting at the same time
+ * @wakeups: Number of waiting threads woken up by sem_up() and sem_up_n()
+ * @spun: Number of acquisitions which found no resource available but got one
+ *	  by spinning for a while instead of waiting
+ *
+ * Statistics are only kept when the library is built with SEM_STATS defined
+ * (make S=1), so that semaphores cost nothing more otherwise.
+ */
+struct sem_stats {
+	unsigned long acquisitions;
+	unsigned long contended;
+	unsigned long long wait_ns;
+	unsigned long long max_wait_ns;
+	unsigned int max_depth;
+	unsigned long wakeups;
+	unsigned long spun;
+};
+
+/*
+ * sem_set_name - Name a semaphore
+ * @sem: Semaphore to name
+ * @name: Name of the semaphore
+ *
+ * Name semaphore @sem @name, truncated to SEM_NAME_MAX - 1 characters, so that
+ * its statistics are printed by sem_stats_dump(). The name is ignored if
+ * statistics are not compiled in.
+ *
+ * Return: -1 if @sem or @name are NULL. 0 if semaphore was successfully named.
+ */
+int sem_set_name(sem_t sem, const char *name);
+
+/*
+ * sem_stats - Get semaphore usage statistics
+ * @sem: Semaphore to inspect
+ * @stats: Address of statistics where values are received
+ *
+ * Copy the statistics kept for semaphore @sem since its creation to @stats.
+ *
+ * Return: -1 if @sem or @stats are NULL, or if statistics are not compiled in.
+ * 0 if statistics were successfully copied.
+ */
+int sem_stats(sem_t sem, struct sem_stats *stats);
+
+/*
+ * sem_stats_dump - Print statistics of all named semaphores
+ * @stream: Stream to print to
+ *
+ * Print one line per existing semaphore named with sem_set_name(), with its
+ * name followed by its statistics, to @stream.
+ *
+ * Return: -1 if @stream is NULL, or if statistics are not compiled in. 0 if
+ * statistics were successfully printed.
+ */
+int sem_stats_dump(FILE *stream);
+
 #endif /* _SEMAPHORE_H */
@@ -1,89 +1,1051 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "queue.h"
-#include "thread.h"
+#include "rwlock.h"
 #include "tps.h"
 
+/* Size of a memory page, TPS areas are made of whole pages */
+#define TPS_PAGE_SIZE 4096
+
+/* Number of pages needed to hold @size bytes */
+#define PAGES(size) (((size) + TPS_PAGE_SIZE - 1) / TPS_PAGE_SIZE)
+
 /* 
  * Page struct:
- * adr:		address in memory where TPS exists
+ * off:		offset in the backing file where the page content exists
  * refCount:	number of TPS structs pointing to page
+ * next:	next page in the free list of the page pool
 */
 typedef struct page {
-	char* adr;
+	off_t off;
 	int refCount;
+	struct page *next;
 } *page_p;
 
 /*
  * Tps struct:
  * tid:		TID of thread using the TPS
- * currPage:	page the TPS is pointing to
+ * adr:		address in memory where the TPS area begins
+ * size:	size of the TPS area in bytes
+ * pageCount:	number of pages of the TPS area
+ * pages:	page mapped at each page of the TPS area
+ * open:	access the thread has to the TPS area right now, PROT_NONE,
+ *		PROT_READ or PROT_READ | PROT_WRITE
+ * mapped:	whether the thread mapped the TPS area with tps_map(), its
+ *		pages are then protected with mprotect() even with a
+ *		protection key
+ * link:	link in the registry bucket the TPS is hashed to, or in the
+ *		cache of the page pool
+ *
+ * Each page of the area maps a page of the backing file, so that several TPS
+ * areas can share a page and a shared page can be copied on its own.
 */
 typedef struct tps {
 	pthread_t tid;
-	page_p currPage;
+	char* adr;
+	size_t size;
+	size_t pageCount;
+	page_p *pages;
+	int open;
+	int mapped;
+	struct queue_link link;
 } *tps_p;
 
-/* Global queue of TPS structs */
-queue_t tpsQueue;
+/*
+ * Registry struct:
+ * buckets:	hash table of intrusive queues of TPS, indexed by hashed TID
+ * bits:	log2 of the number of buckets
+ * count:	number of TPS structs in the registry
+*/
+struct registry {
+	struct queue_list *buckets;
+	unsigned int bits;
+	size_t count;
+};
+
+/* Initial registry size, grows by doubling once the load factor exceeds 1 */
+#define REGISTRY_BITS 6
+
+/* Global registry of TPS structs, keyed by TID */
+static struct registry tpsRegistry;
+
+/*
+ * Lock of the registry and of everything reachable from it, independent from
+ * the critical section of the thread library so that semaphores do not
+ * contend with TPS operations. Reads of TPS areas only look the registry up
+ * and read the area of the current thread, so they take it for reading and
+ * run in parallel, while every other operation takes it for writing. Writers
+ * may take it again, so that the signal handler can take it while tps_write()
+ * holds it. Created by tps_init().
+ */
+static rwlock_t tpsLock;
+
+/* Helper function to hash a TID into a registry bucket (Fibonacci hashing) */
+static size_t hashTid(pthread_t tid, unsigned int bits)
+{
+	return (size_t)(((uint64_t)tid * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+}
+
+/* Helper function to find the TPS of certain thread */
+static tps_p registryFind(pthread_t tid)
+{
+	struct queue_list *bucket = &tpsRegistry.buckets[hashTid(tid, tpsRegistry.bits)];
+	struct queue_link *link;
+	tps_p currTps;
+
+	for (link = queue_list_first(bucket); link != NULL; link = link->next)
+	{
+		currTps = queue_entry(link, struct tps, link);
+		if (pthread_equal(currTps->tid, tid))
+			return currTps;
+	}
+
+	return NULL;
+}
+
+/* Helper function to double the number of buckets of the registry */
+static int registryGrow(void)
+{
+	unsigned int bits = tpsRegistry.bits + 1;
+	struct queue_list *buckets = calloc((size_t)1 << bits,
+					    sizeof(struct queue_list));
+	struct queue_link *link;
+	size_t i;
+
+	if (buckets == NULL)
+		return -1;
+
+	/* Rehashes every bucket into the new table */
+	for (i = 0; i < ((size_t)1 << tpsRegistry.bits); i++)
+	{
+		while ((link = queue_list_dequeue(&tpsRegistry.buckets[i])) != NULL)
+		{
+			tps_p currTps = queue_entry(link, struct tps, link);
+
+			queue_list_enqueue(&buckets[hashTid(currTps->tid, bits)], link);
+		}
+	}
+
+	free(tpsRegistry.buckets);
+	tpsRegistry.buckets = buckets;
+	tpsRegistry.bits = bits;
+
+	return 0;
+}
+
+/* Helper function to add a TPS to the registry */
+static int registryInsert(tps_p newTps)
+{
+	size_t b;
+
+	if (tpsRegistry.count >= ((size_t)1 << tpsRegistry.bits)
+			&& registryGrow() == -1)
+		return -1;
+
+	b = hashTid(newTps->tid, tpsRegistry.bits);
+	queue_list_enqueue(&tpsRegistry.buckets[b], &newTps->link);
+	tpsRegistry.count++;
+
+	return 0;
+}
+
+/* Helper function to remove a TPS from the registry */
+static void registryRemove(tps_p oldTps)
+{
+	queue_list_delete(&tpsRegistry.buckets[hashTid(oldTps->tid, tpsRegistry.bits)],
+			  &oldTps->link);
+	tpsRegistry.count--;
+}
+
+/*
+ * Page index struct:
+ * mask:	number of slots minus one, the number of slots is a power of two
+ * used:	number of slots that are not empty (live or deleted entries)
+ * adr:		page address of each slot, PAGE_EMPTY or PAGE_DELETED if unused
+ * areas:	TPS whose area contains the page of each slot
+ *
+ * The page index maps the address of every page of every TPS area to its TPS.
+ * It is only modified under the TPS lock, but it is read without any
+ * lock by the signal handler: slots are published with atomic stores, and a
+ * full table is replaced by a bigger copy instead of being modified in place.
+*/
+struct pageIndex {
+	size_t mask;
+	size_t used;
+	_Atomic uintptr_t *adr;
+	tps_p *areas;
+};
+
+#define PAGE_EMPTY	((uintptr_t)0)
+#define PAGE_DELETED	((uintptr_t)1)
+
+/* Initial number of slots of the page index */
+#define PAGE_INDEX_SIZE 64
+
+/* Page index currently in use, and number of signal handlers reading it */
+static _Atomic(struct pageIndex*) tpsPages;
+static atomic_int tpsPagesReaders;
+
+/* Helper function to hash a page address into a page index slot */
+static size_t hashPage(uintptr_t adr, size_t mask)
+{
+	return (size_t)(((uint64_t)(adr / TPS_PAGE_SIZE) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+/* Helper function to allocate an empty page index */
+static struct pageIndex *pageIndexCreate(size_t size)
+{
+	struct pageIndex *index = malloc(sizeof(struct pageIndex));
+
+	if (index == NULL)
+		return NULL;
+
+	index->mask = size - 1;
+	index->used = 0;
+	index->adr = calloc(size, sizeof(uintptr_t));
+	index->areas = calloc(size, sizeof(tps_p));
+	if (index->adr == NULL || index->areas == NULL)
+	{
+		free(index->adr);
+		free(index->areas);
+		free(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+/* Helper function to find the TPS of the page at @adr, without locking */
+static tps_p pageIndexFind(struct pageIndex *index, uintptr_t adr)
+{
+	size_t i = hashPage(adr, index->mask);
+	uintptr_t key;
+
+	while ((key = atomic_load(&index->adr[i])) != PAGE_EMPTY)
+	{
+		if (key == adr)
+		{
+			tps_p area = index->areas[i];
+
+			/* Makes sure the slot was not reused while reading it */
+			if (atomic_load(&index->adr[i]) == adr)
+				return area;
+			continue;
+		}
+		i = (i + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+/* Helper function to put a page in a slot of an index nobody else can see */
+static void pageIndexPut(struct pageIndex *index, uintptr_t adr, tps_p area)
+{
+	size_t i = hashPage(adr, index->mask);
+
+	while (atomic_load_explicit(&index->adr[i], memory_order_relaxed) > PAGE_DELETED)
+		i = (i + 1) & index->mask;
+
+	index->areas[i] = area;
+	atomic_store_explicit(&index->adr[i], adr, memory_order_relaxed);
+	index->used++;
+}
+
+/*
+ * Helper function to replace the page index by a copy with room for @live
+ * more pages. The old index is freed once no signal handler is reading it.
+*/
+static int pageIndexRebuild(size_t live)
+{
+	struct pageIndex *old = atomic_load(&tpsPages);
+	struct pageIndex *index;
+	size_t size = PAGE_INDEX_SIZE, i;
+
+	while (size < 4 * live)
+		size *= 2;
+
+	index = pageIndexCreate(size);
+	if (index == NULL)
+		return -1;
+
+	for (i = 0; i <= old->mask; i++)
+	{
+		uintptr_t adr = atomic_load_explicit(&old->adr[i], memory_order_relaxed);
+
+		if (adr > PAGE_DELETED)
+			pageIndexPut(index, adr, old->areas[i]);
+	}
+
+	atomic_store(&tpsPages, index);
+	while (atomic_load(&tpsPagesReaders) != 0)
+		sched_yield();
+
+	free(old->adr);
+	free(old->areas);
+	free(old);
+
+	return 0;
+}
+
+/* Helper function to add a page to the page index */
+static int pageIndexInsert(uintptr_t adr, tps_p area)
+{
+	struct pageIndex *index = atomic_load(&tpsPages);
+	size_t i;
+
+	/* Keeps at least a quarter of the slots empty so that lookups end */
+	if (4 * (index->used + 1) > 3 * (index->mask + 1))
+	{
+		size_t live = 0;
+
+		for (i = 0; i <= index->mask; i++)
+			if (atomic_load_explicit(&index->adr[i], memory_order_relaxed) > PAGE_DELETED)
+				live++;
+
+		if (pageIndexRebuild(live + 1) == -1)
+			return -1;
+		index = atomic_load(&tpsPages);
+	}
+
+	i = hashPage(adr, index->mask);
+	while (atomic_load_explicit(&index->adr[i], memory_order_relaxed) > PAGE_DELETED)
+		i = (i + 1) & index->mask;
+
+	/* Publishes the TPS before the page address */
+	if (atomic_load_explicit(&index->adr[i], memory_order_relaxed) == PAGE_EMPTY)
+		index->used++;
+	index->areas[i] = area;
+	atomic_store(&index->adr[i], adr);
+
+	return 0;
+}
+
+/* Helper function to remove a page from the page index */
+static void pageIndexRemove(uintptr_t adr)
+{
+	struct pageIndex *index = atomic_load(&tpsPages);
+	size_t i = hashPage(adr, index->mask);
+	uintptr_t key;
+
+	while ((key = atomic_load_explicit(&index->adr[i], memory_order_relaxed)) != PAGE_EMPTY)
+	{
+		if (key == adr)
+		{
+			atomic_store(&index->adr[i], PAGE_DELETED);
+			return;
+		}
+		i = (i + 1) & index->mask;
+	}
+}
+
+/* Helper function to find the TPS area containing a faulting address */
+static tps_p pageIndexLookup(void* adr)
+{
+	struct pageIndex *index;
+	tps_p area = NULL;
+
+	atomic_fetch_add(&tpsPagesReaders, 1);
+	index = atomic_load(&tpsPages);
+	if (index != NULL)
+		area = pageIndexFind(index, (uintptr_t)adr);
+	atomic_fetch_sub(&tpsPagesReaders, 1);
+
+	return area;
+}
+
+/* Helper function to add every page of a TPS area to the page index */
+static int areaIndex(tps_p area)
+{
+	size_t i;
+
+	for (i = 0; i < area->pageCount; i++)
+	{
+		if (pageIndexInsert((uintptr_t)area->adr + i * TPS_PAGE_SIZE, area) == -1)
+		{
+			while (i-- > 0)
+				pageIndexRemove((uintptr_t)area->adr + i * TPS_PAGE_SIZE);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Helper function to remove every page of a TPS area from the page index */
+static void areaUnindex(tps_p area)
+{
+	size_t i;
+
+	for (i = 0; i < area->pageCount; i++)
+		pageIndexRemove((uintptr_t)area->adr + i * TPS_PAGE_SIZE);
+}
+
+/*
+ * Page pool of the TPS pages
+ *
+ * The content of every TPS page lives in an anonymous memory file, which TPS
+ * areas map page by page. Sharing a page between two TPS areas is mapping
+ * the same page of the file in both, and copying it on write is moving the
+ * content to another page of the file and mapping that one instead.
+ *
+ * A large part of the file is reserved up front, unused parts of it do not
+ * take any memory. Pages whose refCount drops to zero give their memory back
+ * and are kept in a free list to be handed out again. Destroyed TPS areas of a
+ * few pages which do not share any page are kept whole in a cache, still
+ * mapped, so that a thread creating a TPS of the same size right after can
+ * reuse one without any system call.
+*/
+static int tpsFile = -1;
+static off_t tpsFileEnd, tpsFileSize;
+
+/* Free pages, linked through their next field, and their number */
+static page_p poolFree;
+static size_t poolFreeCount;
+
+/*
+ * Number of copies of shared pages writes may still cause, one less than the
+ * refCount of every shared page. The signal handler makes them, and must not
+ * allocate memory, so poolRefill() keeps at least as many free pages.
+ */
+static size_t poolCopies;
+
+/* Cached TPS areas by page count, linked through their link field */
+#define CACHE_PAGES	16
+#define CACHE_MAX	256
+static struct queue_list poolCache[CACHE_PAGES + 1];
+static size_t poolCached;
+
+static struct tps_pool_stats poolStats;
+
+/* Number of pages in use with a refCount above 1 */
+static size_t poolShared;
+
+/* Size of the backing file reserved up front, grows by doubling */
+#define FILE_SIZE ((off_t)64 * 1024 * 1024)
+
+/* Helper function to make a new page at the end of the backing file */
+static page_p pageNew(void)
+{
+	page_p page;
+
+	/* Grows the backing file if needed */
+	if (tpsFileEnd + TPS_PAGE_SIZE > tpsFileSize)
+	{
+		if (ftruncate(tpsFile, tpsFileSize * 2) == -1)
+			return NULL;
+		tpsFileSize *= 2;
+	}
+
+	page = malloc(sizeof(struct page));
+	if (page == NULL)
+		return NULL;
+	page->off = tpsFileEnd;
+	tpsFileEnd += TPS_PAGE_SIZE;
+
+	return page;
+}
+
+/* Helper function to hand out a page, zero-filled unless reused by a cache */
+static page_p pageGet(void)
+{
+	page_p page = poolFree;
+
+	if (page != NULL)
+	{
+		poolFree = page->next;
+		poolFreeCount--;
+		poolStats.pages_free--;
+	}
+	else
+	{
+		page = pageNew();
+		if (page == NULL)
+			return NULL;
+	}
+
+	page->refCount = 1;
+	page->next = NULL;
+
+	if (++poolStats.pages_in_use > poolStats.pages_high_water)
+		poolStats.pages_high_water = poolStats.pages_in_use;
+
+	return page;
+}
+
+/* Helper function to drop a reference to a page, freeing it if it was the last */
+static void pageRelease(page_p page)
+{
+	if (--page->refCount > 0)
+	{
+		poolCopies--;
+		if (page->refCount == 1)
+			poolShared--;
+		return;
+	}
+
+	/* Gives the memory of the page back, its content reads as zeros again */
+	fallocate(tpsFile, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  page->off, TPS_PAGE_SIZE);
+
+	page->next = poolFree;
+	poolFree = page;
+	poolFreeCount++;
+	poolStats.pages_in_use--;
+	poolStats.pages_free++;
+}
+
+/*
+ * Helper function to make sure that the signal handler finds a free page for
+ * every copy it may have to make, called under the TPS lock after operations
+ * which take free pages or share pages
+ */
+static int poolRefill(void)
+{
+	page_p page;
+
+	while (poolFreeCount < poolCopies)
+	{
+		page = pageNew();
+		if (page == NULL)
+			return -1;
+
+		page->next = poolFree;
+		poolFree = page;
+		poolFreeCount++;
+		poolStats.pages_free++;
+	}
+
+	return 0;
+}
+
+/* Helper function to hand out @count pages */
+static page_p *pageAlloc(size_t count)
+{
+	page_p *pages = calloc(count, sizeof(page_p));
+	size_t i;
+
+	if (pages == NULL)
+		return NULL;
+
+	for (i = 0; i < count; i++)
+	{
+		pages[i] = pageGet();
+		if (pages[i] == NULL)
+		{
+			while (i-- > 0)
+				pageRelease(pages[i]);
+			free(pages);
+			return NULL;
+		}
+	}
+
+	return pages;
+}
+
+/*
+ * Statistics of TPS operations
+ *
+ * Every thread counts its own operations in its own counters, allocated on its
+ * first operation and linked in a list, so that counting an operation does not
+ * take any lock nor share any cache line. Only one call in TPS_STATS_PERIOD is
+ * timed, as reading the clock twice costs as much as a whole TPS read.
+ * Counters are only written by their thread, with relaxed atomic stores, and
+ * read by tps_stats() which sums them up under statsLock, which also protects
+ * the list. Those of an exiting thread are added to the ones of the threads
+ * which already exited. The other statistics are only updated under the TPS
+ * lock taken for writing, like the page pool, except for the protection calls
+ * which reads also make, counted atomically.
+*/
+struct opCounters {
+	atomic_ulong count;
+	atomic_ulong timed;
+	atomic_ullong total;
+	atomic_ulong hist[TPS_HIST_BUCKETS];
+};
+
+struct tpsCounters {
+	struct opCounters ops[TPS_OPS];
+	struct queue_link link;
+};
+
+static struct queue_list statsThreads;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static struct tps_op_stats statsExited[TPS_OPS];
+static pthread_key_t statsKey;
+static __thread struct tpsCounters *statsLocal;
+
+static unsigned long statsCowCopies;
+static unsigned long long statsCowBytes;
+static atomic_ulong statsProtectCalls;
+
+/* Helper function to get the current time, to time operations */
+static unsigned long long statsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Helper function to add @value to a counter only the current thread writes */
+static void statsAdd(atomic_ulong *counter, unsigned long value)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter,
+			memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/* Helper function to add the counters of a thread to @ops */
+static void statsSum(struct tps_op_stats *ops, struct tpsCounters *counters)
+{
+	int op, i;
+
+	for (op = 0; op < TPS_OPS; op++)
+	{
+		ops[op].count += atomic_load_explicit(&counters->ops[op].count,
+				memory_order_relaxed);
+		ops[op].timed += atomic_load_explicit(&counters->ops[op].timed,
+				memory_order_relaxed);
+		ops[op].total_ns += atomic_load_explicit(&counters->ops[op].total,
+				memory_order_relaxed);
+		for (i = 0; i < TPS_HIST_BUCKETS; i++)
+			ops[op].hist[i] += atomic_load_explicit(
+					&counters->ops[op].hist[i], memory_order_relaxed);
+	}
+}
+
+/* Destructor of the counters of an exiting thread */
+static void statsExit(void *arg)
+{
+	struct tpsCounters *counters = arg;
+
+	pthread_mutex_lock(&statsLock);
+	statsSum(statsExited, counters);
+	queue_list_delete(&statsThreads, &counters->link);
+	pthread_mutex_unlock(&statsLock);
+
+	free(counters);
+}
+
+/*
+ * Helper function to get the time operation @op of the current thread starts
+ * at, or 0 if this call is not to be timed
+ */
+static unsigned long long statsStart(enum tps_op op)
+{
+	struct tpsCounters *counters = statsLocal;
+
+	if (counters != NULL && (atomic_load_explicit(&counters->ops[op].count,
+			memory_order_relaxed) & (TPS_STATS_PERIOD - 1)) != 0)
+		return 0;
+
+	return statsNow();
+}
+
+/*
+ * Helper function to count operation @op of the current thread, and time it
+ * since @start unless 0
+ */
+static void statsRecord(enum tps_op op, unsigned long long start)
+{
+	struct tpsCounters *counters = statsLocal;
+	unsigned long long ns;
+	int bucket = 0;
+
+	/* Allocates the counters of the thread on its first operation */
+	if (counters == NULL)
+	{
+		counters = calloc(1, sizeof(struct tpsCounters));
+		if (counters == NULL)
+			return;
+
+		pthread_mutex_lock(&statsLock);
+		queue_list_enqueue(&statsThreads, &counters->link);
+		pthread_mutex_unlock(&statsLock);
+		pthread_setspecific(statsKey, counters);
+		statsLocal = counters;
+	}
+
+	statsAdd(&counters->ops[op].count, 1);
+	if (start == 0)
+		return;
+
+	ns = statsNow() - start;
+	while (bucket < TPS_HIST_BUCKETS - 1 && (ns >> (bucket + 1)) != 0)
+		bucket++;
+
+	statsAdd(&counters->ops[op].timed, 1);
+	atomic_store_explicit(&counters->ops[op].total, atomic_load_explicit(
+			&counters->ops[op].total, memory_order_relaxed) + ns,
+			memory_order_relaxed);
+	statsAdd(&counters->ops[op].hist[bucket], 1);
+}
+
+/* Helper function to find the TPS of certain thread, timing the lookup */
+static tps_p tpsFind(pthread_t tid)
+{
+	unsigned long long start = statsStart(TPS_OP_LOOKUP);
+	tps_p currTps = registryFind(tid);
+
+	statsRecord(TPS_OP_LOOKUP, start);
+	return currTps;
+}
+
+/*
+ * Protection key of the TPS pages, or -1 if they are protected with mprotect()
+ *
+ * With a protection key, TPS pages are mapped once and for all, and access to
+ * them is granted to the current thread only by toggling the key's rights in
+ * its PKRU register, which is a user-space register write instead of two
+ * mprotect() system calls per access.
+ *
+ * All TPS areas share the key though, so opening it for as long as an area is
+ * mapped with tps_map() would give the thread access to all the others. The
+ * pages of a mapped area are moved to the default key and protected with
+ * mprotect() instead, until tps_unmap() gives them back to the TPS key.
+*/
+static int tpsPkey = -1;
+
+/* Whether the signal handler should report TPS protection errors */
+static int tpsSegv;
+
+/* TPS the current thread has mapped with tps_map(), if any */
+static __thread tps_p tpsMapped;
+
+/* TPS the current thread has open for writing, if any */
+static __thread tps_p tpsWriting;
+
+/* Helper function to get the protection key of the pages of a TPS area */
+static int areaKey(tps_p area)
+{
+	return area->mapped ? 0 : tpsPkey;
+}
+
+/*
+ * Helper function to get the protection of a page of a TPS area, given the
+ * access the thread owning the area currently has to it
+ *
+ * Pages shared with other TPS areas are never mapped writable, so that the
+ * first write to them faults and the signal handler copies them.
+*/
+static int pageProt(tps_p area, page_p page)
+{
+	/* With mprotect(), pages are only accessible while open */
+	if (areaKey(area) <= 0 && !(area->open & PROT_WRITE))
+		return area->open;
+
+	return (page->refCount > 1) ? PROT_READ : PROT_READ | PROT_WRITE;
+}
+
+/* Helper function to find how many pages from @i have the same protection */
+static size_t pageRun(tps_p area, size_t i, size_t end)
+{
+	size_t run = 1;
+
+	while (i + run < end && pageProt(area, area->pages[i + run]) ==
+			pageProt(area, area->pages[i]))
+		run++;
 
-/* Helper function to find address of seg faults */
-int findSegV(void* data, void* arg)
+	return run;
+}
+
+/* Helper function to apply protection to pages [@first, @first + @count) */
+static int areaProtect(tps_p area, size_t first, size_t count)
 {
-	tps_p currTps = (tps_p)data;
-	char* adr = (char*)arg;
+	size_t i = first, run;
 
-	if (currTps->currPage->adr == adr)
+	for (; i < first + count; i += run)
 	{
-		return 1;
+		char* adr = area->adr + i * TPS_PAGE_SIZE;
+		int prot = pageProt(area, area->pages[i]);
+		int ret;
+
+		run = pageRun(area, i, first + count);
+#ifdef PKEY_DISABLE_ACCESS
+		if (tpsPkey != -1)
+			ret = pkey_mprotect(adr, run * TPS_PAGE_SIZE, prot, areaKey(area));
+		else
+#endif
+			ret = mprotect(adr, run * TPS_PAGE_SIZE, prot);
+		atomic_fetch_add_explicit(&statsProtectCalls, 1, memory_order_relaxed);
+		if (ret == -1)
+			return -1;
 	}
 
 	return 0;
 }
 
-/* Helper function to find TID of certain thread */
-int findTid(void* data, void* arg)
+/* Helper function to map pages [@first, @first + @count) of a TPS area */
+static int areaMap(tps_p area, size_t first, size_t count)
+{
+	size_t i = first;
+
+	while (i < first + count)
+	{
+		size_t run = 1;
+		char* adr = area->adr + i * TPS_PAGE_SIZE;
+
+		/* Maps consecutive pages of the backing file at once */
+		while (i + run < first + count && area->pages[i + run]->off ==
+				area->pages[i]->off + (off_t)(run * TPS_PAGE_SIZE))
+			run++;
+
+		if (mmap(adr, run * TPS_PAGE_SIZE, PROT_NONE, MAP_SHARED | MAP_FIXED,
+			 tpsFile, area->pages[i]->off) == MAP_FAILED)
+			return -1;
+
+		i += run;
+	}
+
+	return areaProtect(area, first, count);
+}
+
+/*
+ * Helper function to give the current thread @prot access to part of a TPS
+ * area, PROT_READ or PROT_READ | PROT_WRITE
+ */
+static void areaOpen(tps_p area, size_t offset, size_t length, int prot)
 {
-	tps_p currTps = (tps_p)data;
-	pthread_t tid = (pthread_t)arg;
+	size_t first = offset / TPS_PAGE_SIZE;
 
-	if (currTps->tid == tid)
+	area->open = prot;
+	tpsWriting = (prot & PROT_WRITE) ? area : NULL;
+
+#ifdef PKEY_DISABLE_ACCESS
+	if (tpsPkey != -1 && !area->mapped)
 	{
-		return 1;
+		pkey_set(tpsPkey, (prot & PROT_WRITE) ? 0 : PKEY_DISABLE_WRITE);
+		return;
 	}
+#endif
+
+	areaProtect(area, first, PAGES(offset + length) - first);
+}
+
+/* Helper function to protect part of a TPS area again after accessing it */
+static void areaClose(tps_p area, size_t offset, size_t length)
+{
+	size_t first = offset / TPS_PAGE_SIZE;
+
+	area->open = PROT_NONE;
+	tpsWriting = NULL;
+
+#ifdef PKEY_DISABLE_ACCESS
+	if (tpsPkey != -1)
+	{
+		/* Gives the pages of an area mapped by tps_map() back to the key */
+		if (area->mapped)
+		{
+			area->mapped = 0;
+			areaProtect(area, first, PAGES(offset + length) - first);
+		}
+		else
+			pkey_set(tpsPkey, PKEY_DISABLE_ACCESS);
+		return;
+	}
+#endif
+
+	area->mapped = 0;
+	mprotect(area->adr + first * TPS_PAGE_SIZE,
+		 (PAGES(offset + length) - first) * TPS_PAGE_SIZE, PROT_NONE);
+	atomic_fetch_add_explicit(&statsProtectCalls, 1, memory_order_relaxed);
+}
+
+/*
+ * Helper function to make page @i of a TPS area writable for the thread which
+ * has it open for writing: a page shared with other TPS areas is first
+ * copied, and only the copy is made writable.
+*/
+static int pageCopy(tps_p area, size_t i)
+{
+	char buffer[TPS_PAGE_SIZE];
+	page_p oldPage = area->pages[i];
+	page_p newPage;
+
+	/* The other TPS areas stopped sharing the page */
+	if (oldPage->refCount == 1)
+		return areaProtect(area, i, 1);
+
+	newPage = pageGet();
+	if (newPage == NULL)
+		return -1;
+
+	/* Copies the page content within the backing file, then maps the copy */
+	area->pages[i] = newPage;
+	if (pread(tpsFile, buffer, TPS_PAGE_SIZE, oldPage->off) != TPS_PAGE_SIZE ||
+			pwrite(tpsFile, buffer, TPS_PAGE_SIZE, newPage->off) != TPS_PAGE_SIZE ||
+			areaMap(area, i, 1) == -1)
+	{
+		area->pages[i] = oldPage;
+		pageRelease(newPage);
+		return -1;
+	}
+
+	pageRelease(oldPage);
+	statsCowCopies++;
+	statsCowBytes += TPS_PAGE_SIZE;
+
+	return 0;
+}
+
+/* Helper function to allocate a TPS struct for an area of @size bytes */
+static tps_p tpsAlloc(size_t size)
+{
+	tps_p newTps = malloc(sizeof(struct tps));
+
+	if (newTps == NULL)
+		return NULL;
+
+	newTps->tid = pthread_self();
+	newTps->adr = MAP_FAILED;
+	newTps->size = size;
+	newTps->pageCount = PAGES(size);
+	newTps->pages = NULL;
+	newTps->open = PROT_NONE;
+	newTps->mapped = 0;
+
+	return newTps;
+}
+
+/* Helper function to free a TPS struct, its mapping and its pages */
+static void tpsFree(tps_p oldTps)
+{
+	size_t i;
+
+	if (oldTps->adr != MAP_FAILED)
+		munmap(oldTps->adr, oldTps->pageCount * TPS_PAGE_SIZE);
+
+	if (oldTps->pages != NULL)
+		for (i = 0; i < oldTps->pageCount; i++)
+			pageRelease(oldTps->pages[i]);
+
+	free(oldTps->pages);
+	free(oldTps);
+}
+
+/* Helper function to keep a destroyed TPS area in the cache of the page pool */
+static int tpsCache(tps_p oldTps)
+{
+	size_t i;
+
+	if (oldTps->pageCount > CACHE_PAGES || poolCached == CACHE_MAX)
+		return -1;
+
+	for (i = 0; i < oldTps->pageCount; i++)
+		if (oldTps->pages[i]->refCount > 1)
+			return -1;
+
+	queue_list_enqueue(&poolCache[oldTps->pageCount], &oldTps->link);
+	poolCached++;
+	poolStats.pages_in_use -= oldTps->pageCount;
+	poolStats.pages_free += oldTps->pageCount;
 
 	return 0;
 }
 
-/* Error handler to determine whether seg fault is a TPS protection error */
+/* Helper function to reuse a cached TPS area of @size bytes, if any */
+static tps_p tpsUncache(size_t size)
+{
+	struct queue_link *link;
+	tps_p newTps;
+
+	if (PAGES(size) > CACHE_PAGES ||
+			(link = queue_list_dequeue(&poolCache[PAGES(size)])) == NULL)
+		return NULL;
+
+	newTps = queue_entry(link, struct tps, link);
+	poolCached--;
+	poolStats.pages_in_use += newTps->pageCount;
+	poolStats.pages_free -= newTps->pageCount;
+
+	newTps->tid = pthread_self();
+	newTps->size = size;
+
+	return newTps;
+}
+
+/* Helper function to make a new TPS visible to the registry and the handler */
+static int tpsRegister(tps_p newTps)
+{
+	if (areaIndex(newTps) == -1)
+		return -1;
+
+	if (registryInsert(newTps) == -1)
+	{
+		areaUnindex(newTps);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Error handler to resolve copy-on-write faults, and determine whether other
+ * seg faults are TPS protection errors
+ */
 static void segv_handler(int sig, siginfo_t *si, void *context)
 {
-	tps_p currTps = NULL;
+	static const char msg[] = "TPS protection error!\n";
+	tps_p area = NULL;
 	
 	/*
 	* Get the address corresponding to the beginning of the page where the
 	* fault occurred
 	*/
-	void *p_fault = (void*)((uintptr_t)si->si_addr & ~(TPS_SIZE - 1));
+	void *p_fault = (void*)((uintptr_t)si->si_addr & ~(TPS_PAGE_SIZE - 1));
 
 	/*
-	* Iterate through all the TPS areas and find if p_fault matches one of them
+	* A fault in the area the current thread has open for writing is a write
+	* to a shared page, either in tps_write()'s memcpy() or through the
+	* pointer returned by tps_map(). The handler may take the TPS lock because
+	* such faults are synchronous: they happen on a write to TPS memory, never
+	* while the thread is inside the lock, malloc() or any other function
+	* which is not reentrant, and tps_write() holds the lock as a writer,
+	* which can take it again. Only the area of the current thread is looked
+	* at, under the lock, as the area another thread faults on may be freed
+	* meanwhile. The page is then copied as if tps_write() did it itself, with
+	* pread(), pwrite() and mmap() system calls, and a free page poolRefill()
+	* set aside, so that nothing is allocated. Returning retries the write,
+	* now to the copy.
 	*/
-	queue_iterate(tpsQueue, findSegV, p_fault, (void**)&currTps);
+	if (tpsWriting != NULL)
+	{
+		int ret = -1;
+
+		rwlock_wrlock(tpsLock);
+		area = tpsWriting;
+		if ((char*)p_fault >= area->adr &&
+				(char*)p_fault < area->adr + area->pageCount * TPS_PAGE_SIZE)
+			ret = pageCopy(area, ((char*)p_fault - area->adr) / TPS_PAGE_SIZE);
+		rwlock_unlock(tpsLock);
+
+		if (ret == 0)
+			return;
+	}
+
+	/*
+	* Look p_fault up in the page index to find if it matches one of the TPS
+	* areas
+	*/
+	area = pageIndexLookup(p_fault);
 	
-	if (currTps != NULL)
+	if (area != NULL && tpsSegv)
 	{
 		/*if there is a match */
-		/* Printf the following error message */
-		fprintf(stderr, "TPS protection error!\n");
+		/* Print the following error message, stdio is not signal safe */
+		write(STDERR_FILENO, msg, sizeof(msg) - 1);
 	}
 
 	/* In any case, restore the default signal handlers */
@@ -93,15 +1055,47 @@ static void segv_handler(int sig, siginfo_t *si, void *context)
 	raise(sig);
 }
 
-/* Initializes the error handler and creates global queue */
+/* Initializes the error handler and creates global registry */
 int tps_init(int segv)
 {
-	if (tpsQueue != NULL)
+	if (tpsRegistry.buckets != NULL)
+		return -1;
+
+	tpsRegistry.buckets = calloc((size_t)1 << REGISTRY_BITS,
+				     sizeof(struct queue_list));
+	if (tpsRegistry.buckets == NULL)
+		return -1;
+	tpsRegistry.bits = REGISTRY_BITS;
+	tpsRegistry.count = 0;
+	tpsFileSize = FILE_SIZE;
+	queue_list_init(&statsThreads);
+
+	atomic_store(&tpsPages, pageIndexCreate(PAGE_INDEX_SIZE));
+	tpsLock = rwlock_create(RWLOCK_PREFER_WRITERS);
+	tpsFile = memfd_create("tps", MFD_CLOEXEC);
+	if (atomic_load(&tpsPages) == NULL || tpsLock == NULL || tpsFile == -1 ||
+			ftruncate(tpsFile, FILE_SIZE) == -1 ||
+			pthread_key_create(&statsKey, statsExit) != 0)
+	{
+		if (tpsFile != -1)
+			close(tpsFile);
+		tpsFile = -1;
+		rwlock_destroy(tpsLock);
+		tpsLock = NULL;
+		free(tpsRegistry.buckets);
+		tpsRegistry.buckets = NULL;
 		return -1;
+	}
 
-	tpsQueue = queue_create();
+#ifdef PKEY_DISABLE_ACCESS
+	/* Protects TPS pages with a protection key when the system supports it */
+	if (getenv("TPS_NO_PKEYS") == NULL)
+		tpsPkey = pkey_alloc(0, PKEY_DISABLE_ACCESS);
+#endif
 
-	if (segv) {
+	/* The handler is always needed to copy shared pages on write */
+	tpsSegv = segv;
+	{
 		struct sigaction sa;
 
 		sigemptyset(&sa.sa_mask);
@@ -114,204 +1108,410 @@ int tps_init(int segv)
 	return 0;
 }
 
-/* Creates a TPS for current running thread */
-int tps_create(void)
+/* Gives statistics about the page pool */
+int tps_pool_stats(struct tps_pool_stats *stats)
 {
-	pthread_t tid = pthread_self();
-	tps_p currTps = NULL;
-	queue_iterate(tpsQueue, findTid, (void*)tid, (void**)&currTps);
-	
-	if (currTps) {
+	if (stats == NULL)
 		return -1;
-	}
 
-	tps_p newTps = malloc(sizeof(tps_p));
-	newTps->currPage = malloc(sizeof(page_p));
-	void* mMap;
+	rwlock_rdlock(tpsLock);
+	*stats = poolStats;
+	rwlock_unlock(tpsLock);
 
-	enter_critical_section();
+	return 0;
+}
 
-	/* Maps a location in memory for new TPS */
-	mMap = mmap(NULL, TPS_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+/* Gives statistics about TPS operations of all threads */
+int tps_stats(struct tps_stats *stats)
+{
+	struct queue_link *link;
 
-	/* Initializes new TPS */
-	newTps->tid = pthread_self();
-	newTps->currPage->adr = mMap;
-	newTps->currPage->refCount = 1;
+	if (stats == NULL || tpsRegistry.buckets == NULL)
+		return -1;
 
-	/* Puts new TPS in global queue */
-	queue_enqueue(tpsQueue, (void*)newTps);
+	pthread_mutex_lock(&statsLock);
+	memcpy(stats->ops, statsExited, sizeof(statsExited));
+	for (link = queue_list_first(&statsThreads); link != NULL; link = link->next)
+		statsSum(stats->ops, queue_entry(link, struct tpsCounters, link));
+	pthread_mutex_unlock(&statsLock);
 
-	exit_critical_section();
+	rwlock_rdlock(tpsLock);
+	stats->cow_copies = statsCowCopies;
+	stats->cow_bytes = statsCowBytes;
+	stats->protect_calls = atomic_load(&statsProtectCalls);
+	stats->pages_shared = poolShared;
+	stats->pages_private = poolStats.pages_in_use - poolShared;
+	rwlock_unlock(tpsLock);
 
 	return 0;
 }
 
-/* Destroys TPS of currently running thread */
-int tps_destroy(void)
+/* Tells whether TPS pages are protected with a protection key */
+int tps_fast_access(void)
 {
-	pthread_t tid = pthread_self();
-	tps_p currTps = NULL;
+	return tpsPkey != -1;
+}
 
-	/* Finds TPS of currently running thread */
-	queue_iterate(tpsQueue, findTid, (void*)tid, (void**)&currTps);
-	
-	/* Checks if TID was found */
-	if (currTps == NULL)
+/* Helper function to create a TPS of a certain size for current running thread */
+static int tpsCreate(size_t size)
+{
+	tps_p newTps;
+
+	if (size == 0)
+		return -1;
+
+	rwlock_wrlock(tpsLock);
+
+	/* Checks if current thread already has a TPS */
+	if (tpsFind(pthread_self()) != NULL)
 	{
-		exit_critical_section();
+		rwlock_unlock(tpsLock);
 		return -1;
 	}
-	
-	/* Checks if TPS exists in global queue */
-	if(queue_delete(tpsQueue, (void**)&currTps) == -1)
+
+	/* Reuses a cached TPS area, which only needs to be zero-filled again */
+	newTps = tpsUncache(size);
+	if (newTps != NULL)
+	{
+		if (tpsRegister(newTps) == -1)
+		{
+			tpsFree(newTps);
+			rwlock_unlock(tpsLock);
+			return -1;
+		}
+
+		areaOpen(newTps, 0, newTps->pageCount * TPS_PAGE_SIZE, PROT_READ | PROT_WRITE);
+		memset(newTps->adr, 0, newTps->pageCount * TPS_PAGE_SIZE);
+		areaClose(newTps, 0, newTps->pageCount * TPS_PAGE_SIZE);
+
+		rwlock_unlock(tpsLock);
+		return 0;
+	}
+
+	newTps = tpsAlloc(size);
+	if (newTps == NULL)
 	{
-		exit_critical_section();
+		rwlock_unlock(tpsLock);
 		return -1;
 	}
 
-	/* Removes TPS */
-	currTps->currPage->refCount--;
-	free(currTps->currPage);
-	free(currTps);
+	/* Allocates new pages, zero-filled, and maps them for new TPS */
+	newTps->pages = pageAlloc(newTps->pageCount);
+	if (newTps->pages != NULL)
+		newTps->adr = mmap(NULL, newTps->pageCount * TPS_PAGE_SIZE, PROT_NONE,
+				   MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	/* Puts new TPS in global registry and its pages in the page index */
+	if (newTps->adr == MAP_FAILED || poolRefill() == -1 ||
+			areaMap(newTps, 0, newTps->pageCount) == -1 ||
+			tpsRegister(newTps) == -1)
+	{
+		tpsFree(newTps);
+		rwlock_unlock(tpsLock);
+		return -1;
+	}
 
-	exit_critical_section();
+	rwlock_unlock(tpsLock);
 
 	return 0;
 }
 
-/* Reads to a buffer from TPS of current thread */
-int tps_read(size_t offset, size_t length, char *buffer)
+/* Creates a TPS of a certain size for current running thread */
+int tps_create_sized(size_t size)
 {
-	/* Checks if input arguments are valid */
-	if (offset + length > TPS_SIZE || buffer == NULL)
+	unsigned long long start = statsStart(TPS_OP_CREATE);
+	int ret = tpsCreate(size);
+
+	statsRecord(TPS_OP_CREATE, start);
+	return ret;
+}
+
+/* Creates a TPS for current running thread */
+int tps_create(void)
+{
+	return tps_create_sized(TPS_SIZE);
+}
+
+/* Helper function to destroy TPS of currently running thread */
+static int tpsDestroy(void)
+{
+	pthread_t tid = pthread_self();
+	tps_p currTps;
+
+	rwlock_wrlock(tpsLock);
+
+	/* Finds TPS of currently running thread */
+	currTps = tpsFind(tid);
+	
+	/* Checks if TID was found and if the TPS is not mapped */
+	if (currTps == NULL || currTps == tpsMapped)
+	{
+		rwlock_unlock(tpsLock);
 		return -1;
+	}
+
+	/* Removes TPS, and its pages once no other TPS is pointing to them */
+	registryRemove(currTps);
+	areaUnindex(currTps);
+	if (tpsCache(currTps) == -1)
+		tpsFree(currTps);
 
+	rwlock_unlock(tpsLock);
+
+	return 0;
+}
+
+/* Destroys TPS of currently running thread */
+int tps_destroy(void)
+{
+	unsigned long long start = statsStart(TPS_OP_DESTROY);
+	int ret = tpsDestroy();
+
+	statsRecord(TPS_OP_DESTROY, start);
+	return ret;
+}
+
+/*
+ * Helper function to read or write segments of the TPS of current thread,
+ * with a single lookup, lock and opening of the TPS
+ */
+static int tpsTransfer(const struct tps_iovec *iov, int iovcnt, int write)
+{
 	tps_p currTps = NULL;
 	pthread_t tid = pthread_self();
+	size_t low = SIZE_MAX, high = 0;
+	int i;
 
-	enter_critical_section();
+	/* Checks if input arguments are valid */
+	if (iov == NULL || iovcnt <= 0)
+		return -1;
+
+	/* Reads only need the TPS lock for reading */
+	if (write)
+		rwlock_wrlock(tpsLock);
+	else
+		rwlock_rdlock(tpsLock);
 
 	/* Finds TPS of currently running thread */
-	queue_iterate(tpsQueue, findTid, (void*)tid, (void**)&currTps);
+	currTps = tpsFind(tid);
 
-	/* Checks if TID was found */
-	if (currTps == NULL)
+	/* Checks if TID was found and if the TPS is not mapped */
+	if (currTps == NULL || currTps == tpsMapped)
 	{
-		exit_critical_section();
+		rwlock_unlock(tpsLock);
 		return -1;
 	}
 
-	/* Reads from TPS to buffer */
-	mprotect(currTps->currPage->adr, TPS_SIZE, PROT_READ);
-	memcpy(buffer, currTps->currPage->adr + offset, length);
-	mprotect(currTps->currPage->adr, TPS_SIZE, PROT_NONE);
+	/* Checks that every segment is valid before transferring any */
+	for (i = 0; i < iovcnt; i++)
+	{
+		if (iov[i].buffer == NULL || iov[i].offset > currTps->size ||
+				iov[i].length > currTps->size - iov[i].offset)
+		{
+			rwlock_unlock(tpsLock);
+			return -1;
+		}
+
+		if (iov[i].offset < low)
+			low = iov[i].offset;
+		if (iov[i].offset + iov[i].length > high)
+			high = iov[i].offset + iov[i].length;
+	}
+
+	/*
+	 * Transfers between TPS and buffers, the pages which other TPS are
+	 * pointing to are copied by the signal handler when a write faults on them
+	 */
+	areaOpen(currTps, low, high - low, write ? PROT_READ | PROT_WRITE : PROT_READ);
+	for (i = 0; i < iovcnt; i++)
+	{
+		if (write)
+			memcpy(currTps->adr + iov[i].offset, iov[i].buffer, iov[i].length);
+		else
+			memcpy(iov[i].buffer, currTps->adr + iov[i].offset, iov[i].length);
+	}
+	areaClose(currTps, low, high - low);
+
+	rwlock_unlock(tpsLock);
 
-	exit_critical_section();
-	
 	return 0;
 }
 
+/* Helper function to time a transfer as a read or a write */
+static int tpsTimedTransfer(const struct tps_iovec *iov, int iovcnt, int write)
+{
+	unsigned long long start = statsStart(write ? TPS_OP_WRITE : TPS_OP_READ);
+	int ret = tpsTransfer(iov, iovcnt, write);
+
+	statsRecord(write ? TPS_OP_WRITE : TPS_OP_READ, start);
+	return ret;
+}
+
+/* Reads to a buffer from TPS of current thread */
+int tps_read(size_t offset, size_t length, char *buffer)
+{
+	struct tps_iovec iov = { offset, length, buffer };
+
+	return tpsTimedTransfer(&iov, 1, 0);
+}
+
 /* Writes to a buffer from TPS of current thread */
 int tps_write(size_t offset, size_t length, char *buffer)
 {
-	/* Checks if input arguments are valid */
-	if (offset + length > TPS_SIZE || buffer == NULL)
-		return -1;
-	
+	struct tps_iovec iov = { offset, length, buffer };
+
+	return tpsTimedTransfer(&iov, 1, 1);
+}
+
+/* Reads to several buffers from TPS of current thread at once */
+int tps_readv(const struct tps_iovec *iov, int iovcnt)
+{
+	return tpsTimedTransfer(iov, iovcnt, 0);
+}
+
+/* Writes several buffers to TPS of current thread at once */
+int tps_writev(const struct tps_iovec *iov, int iovcnt)
+{
+	return tpsTimedTransfer(iov, iovcnt, 1);
+}
+
+/* Helper function to make a new TPS point to the same pages as an existing one */
+static int tpsClone(pthread_t tid)
+{
 	tps_p currTps = NULL;
-	tps_p toClone = malloc(sizeof(tps_p));
-	toClone->currPage = malloc(sizeof(page_p));
-	pthread_t tid = pthread_self();
+	tps_p toClone;
+	size_t i;
+	
+	rwlock_wrlock(tpsLock);
 
-	enter_critical_section();
+	/* Checks if current thread already has a TPS */
+	if (tpsFind(pthread_self()) != NULL)
+	{
+		rwlock_unlock(tpsLock);
+		return -1;
+	}
 
-	/* Finds TPS of currently running thread */
-	queue_iterate(tpsQueue, findTid, (void*)tid, (void**)&currTps);
+	/* Finds TPS of thread to clone */
+	currTps = tpsFind(tid);
 
 	/* Checks if TID was found */
 	if (currTps == NULL)
 	{
-		exit_critical_section();
+		rwlock_unlock(tpsLock);
 		return -1;
 	}
 
-	/* Writes to buffer from TPS if only one TPS is pointing to the page */
-	if (currTps->currPage->refCount == 1)
+	toClone = tpsAlloc(currTps->size);
+	if (toClone == NULL)
 	{
-		mprotect(currTps->currPage->adr, TPS_SIZE, PROT_WRITE);
-		memcpy(currTps->currPage->adr + offset, buffer, length);
-		mprotect(currTps->currPage->adr, TPS_SIZE, PROT_NONE);
+		rwlock_unlock(tpsLock);
+		return -1;
 	}
 
-	/* Allocates new page to be written to if multiple TPS pointing */
-	else
+	/* Points new TPS to same pages of found TPS, mapped at a new address */
+	toClone->pages = malloc(toClone->pageCount * sizeof(page_p));
+	if (toClone->pages == NULL)
 	{
-		void* mMap;
-
-		page_p tempPage = currTps->currPage;
-		tempPage->refCount--;
-
-		mMap = mmap(NULL, TPS_SIZE, PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-	
-		/* Allocation of new page */
-		currTps->currPage = malloc(sizeof(page_p));
-		currTps->tid = pthread_self();
-		currTps->currPage->adr = mMap;
-		currTps->currPage->refCount = 1;
-
-		/* Writing to new page */
-		mprotect(tempPage->adr, TPS_SIZE, PROT_READ);
-		memcpy(currTps->currPage->adr, tempPage->adr, TPS_SIZE);
-		memcpy(currTps->currPage->adr + offset, buffer, length);
+		tpsFree(toClone);
+		rwlock_unlock(tpsLock);
+		return -1;
+	}
+	for (i = 0; i < toClone->pageCount; i++)
+	{
+		toClone->pages[i] = currTps->pages[i];
+		if (toClone->pages[i]->refCount++ == 1)
+			poolShared++;
+		poolCopies++;
+	}
 
-		/* Gives pages correct protections */
-		mprotect(currTps->currPage->adr, TPS_SIZE, PROT_NONE);
-		mprotect(tempPage->adr, TPS_SIZE, PROT_NONE);		
+	toClone->adr = mmap(NULL, toClone->pageCount * TPS_PAGE_SIZE, PROT_NONE,
+			    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (toClone->adr == MAP_FAILED ||
+			areaMap(toClone, 0, toClone->pageCount) == -1 ||
+			poolRefill() == -1 || tpsRegister(toClone) == -1)
+	{
+		tpsFree(toClone);
+		rwlock_unlock(tpsLock);
+		return -1;
 	}
 
-	exit_critical_section();
+	/* The cloned pages are shared now, so writing to them must fault */
+	areaProtect(currTps, 0, currTps->pageCount);
+
+	rwlock_unlock(tpsLock);
 	
 	return 0;
 }
 
-/* Makes a new TPS point to the same page as an existing one */
+/* Makes a new TPS point to the same pages as an existing one, without copying them */
 int tps_clone(pthread_t tid)
+{
+	unsigned long long start = statsStart(TPS_OP_CLONE);
+	int ret = tpsClone(tid);
+
+	statsRecord(TPS_OP_CLONE, start);
+	return ret;
+}
+
+/* Gives direct access to TPS of current thread */
+void *tps_map(size_t offset, size_t length, int write)
 {
 	tps_p currTps = NULL;
-	tps_p toClone = malloc(sizeof(tps_p));
-	toClone->currPage = malloc(sizeof(page_p));
-	
-	enter_critical_section();
-	
-	toClone->tid = pthread_self();
+	size_t i;
+
+	rwlock_wrlock(tpsLock);
 
 	/* Finds TPS of currently running thread */
-	queue_iterate(tpsQueue, findTid, (void*)tid, (void**)&currTps);
+	currTps = tpsFind(pthread_self());
 
-	/* Checks if TID was found */
-	if (currTps == NULL)
+	/* Checks if TID was found and if the range is within its bounds */
+	if (currTps == NULL || tpsMapped != NULL || offset > currTps->size ||
+			length > currTps->size - offset)
 	{
-		exit_critical_section();
-		return -1;
+		rwlock_unlock(tpsLock);
+		return NULL;
 	}
 
-	/* Points new TPS to same page of found TPS */
-	toClone->currPage = currTps->currPage;
-	toClone->currPage->refCount++;
+	currTps->mapped = 1;
+	areaOpen(currTps, 0, currTps->size, write ? PROT_READ | PROT_WRITE : PROT_READ);
 
-	/* Phase 2.1 Code */
 	/*
-	mprotect(currTps->currPage->adr, TPS_SIZE, PROT_READ);
-	memcpy(toClone->currPage->adr, currTps->currPage->adr, TPS_SIZE);
-	mprotect(toClone->currPage->adr, TPS_SIZE, PROT_NONE);
-	mprotect(currTps->currPage->adr, TPS_SIZE, PROT_NONE);	
-	*/
+	 * Copies the shared pages of the range right away rather than on the
+	 * first write through the pointer. Pages outside of the range, or shared
+	 * later by tps_clone(), are copied by the signal handler.
+	 */
+	if (write)
+	{
+		for (i = offset / TPS_PAGE_SIZE; i < PAGES(offset + length); i++)
+		{
+			if (currTps->pages[i]->refCount > 1 && pageCopy(currTps, i) == -1)
+			{
+				areaClose(currTps, 0, currTps->size);
+				rwlock_unlock(tpsLock);
+				return NULL;
+			}
+		}
+	}
 
-	queue_enqueue(tpsQueue, (void*)toClone);
+	tpsMapped = currTps;
 
-	exit_critical_section();
-	
-	return 0;
+	rwlock_unlock(tpsLock);
+
+	return currTps->adr + offset;
 }
 
+/* Takes direct access to TPS of current thread back */
+int tps_unmap(void)
+{
+	if (tpsMapped == NULL)
+		return -1;
+
+	rwlock_wrlock(tpsLock);
+
+	areaClose(tpsMapped, 0, tpsMapped->size);
+	tpsMapped = NULL;
+
+	rwlock_unlock(tpsLock);
+
+	return 0;
+}
@@ -6,10 +6,92 @@
 #include <sys/types.h>
 
 /*
- * Size of a TPS area in bytes
+ * Size of a TPS area in bytes, unless created with tps_create_sized()
  */
 #define TPS_SIZE 4096
 
+/*
+ * struct tps_pool_stats - Statistics of the TPS page pool
+ * @pages_in_use: Number of pages currently used by TPS areas
+ * @pages_free: Number of pages kept by the pool to be reused
+ * @pages_high_water: Highest number of pages ever used at the same time
+ */
+struct tps_pool_stats {
+	size_t pages_in_use;
+	size_t pages_free;
+	size_t pages_high_water;
+};
+
+/*
+ * Operations timed by tps_stats(): TPS_OP_LOOKUP is the lookup of the TPS of
+ * the current thread that every other operation starts with
+ */
+enum tps_op {
+	TPS_OP_CREATE,
+	TPS_OP_DESTROY,
+	TPS_OP_READ,
+	TPS_OP_WRITE,
+	TPS_OP_CLONE,
+	TPS_OP_LOOKUP,
+	TPS_OPS
+};
+
+/* Number of buckets of latency histograms */
+#define TPS_HIST_BUCKETS 32
+
+/*
+ * Every thread times one call in TPS_STATS_PERIOD of each operation, starting
+ * with the first one, as reading the clock costs as much as a TPS read
+ */
+#define TPS_STATS_PERIOD 16
+
+/*
+ * struct tps_op_stats - Latency statistics of a TPS operation
+ * @count: Number of calls, successful or not
+ * @timed: Number of these calls which were timed
+ * @total_ns: Total time spent in the timed calls, in nanoseconds
+ * @hist: Histogram of the time of each timed call: bucket i counts the calls
+ *	  which took from 2^i to 2^(i+1) - 1 ns, bucket 0 those under 2 ns and
+ *	  the last bucket any longer one
+ */
+struct tps_op_stats {
+	unsigned long count;
+	unsigned long timed;
+	unsigned long long total_ns;
+	unsigned long hist[TPS_HIST_BUCKETS];
+};
+
+/*
+ * struct tps_stats - Statistics of TPS operations
+ * @ops: Latency statistics of each operation, indexed by enum tps_op, where
+ *	 tps_readv() and tps_writev() count as TPS_OP_READ and TPS_OP_WRITE
+ * @cow_copies: Number of shared pages copied on write
+ * @cow_bytes: Number of bytes copied on write
+ * @protect_calls: Number of mprotect() or pkey_mprotect() system calls
+ * @pages_shared: Number of pages currently shared by several TPS areas
+ * @pages_private: Number of pages currently used by a single TPS area
+ */
+struct tps_stats {
+	struct tps_op_stats ops[TPS_OPS];
+	unsigned long cow_copies;
+	unsigned long long cow_bytes;
+	unsigned long protect_calls;
+	size_t pages_shared;
+	size_t pages_private;
+};
+
+/*
+ * struct tps_iovec - Segment of TPS data
+ * @offset: Offset of the segment in the TPS
+ * @length: Length of the segment
+ * @buffer: Data buffer receiving or holding the data of the segment
+ */
+struct tps_iovec {
+	size_t offset;
+	size_t length;
+	char *buffer;
+};
+
 /*
  * tps_init - Initialize TPS
  * @segv - Activate segfault handler
@@ -19,11 +101,47 @@
  * page fault handler that is able to recognize TPS protection errors and
  * display the message "TPS protection error!\n" on stderr.
  *
+ * TPS areas are protected with memory protection keys when the system supports
+ * them, so that accessing them does not require any system call. Setting the
+ * environment variable TPS_NO_PKEYS forces the use of mprotect() instead.
+ *
  * Return: -1 if TPS API has already been initialized, or in case of failure
  * during the initialization. 0 if the TPS API was successfully initialized.
  */
 int tps_init(int segv);
 
+/*
+ * tps_fast_access - Query TPS protection mode
+ *
+ * Return: 1 if TPS areas are protected with memory protection keys, 0 if they
+ * are protected with mprotect().
+ */
+int tps_fast_access(void);
+
+/*
+ * tps_pool_stats - Get statistics of the TPS page pool
+ * @stats: Address of the structure receiving the statistics
+ *
+ * TPS pages are handed out by a pool, which recycles the pages of destroyed
+ * TPS areas and of copies-on-write once no TPS area points to them anymore.
+ *
+ * Return: -1 if @stats is NULL. 0 if @stats was successfully filled.
+ */
+int tps_pool_stats(struct tps_pool_stats *stats);
+
+/*
+ * tps_stats - Get statistics of TPS operations
+ * @stats: Address of the structure receiving the statistics
+ *
+ * Every thread times its own TPS operations in counters of its own, which are
+ * summed up when queried, including those of threads which have exited since
+ * tps_init().
+ *
+ * Return: -1 if @stats is NULL or if TPS API has not been initialized. 0 if
+ * @stats was successfully filled.
+ */
+int tps_stats(struct tps_stats *stats);
+
 /*
  * tps_create - Create TPS
  *
@@ -36,6 +154,19 @@ int tps_init(int segv);
  */
 int tps_create(void);
 
+/*
+ * tps_create_sized - Create TPS of a certain size
+ * @size: Size of the TPS area in bytes
+ *
+ * Create a TPS area of @size bytes and associate it to the current thread. The
+ * TPS area is made of as many memory pages as needed, and is initialized to all
+ * zeros. Reads and writes are bound by @size.
+ *
+ * Return: -1 if @size is 0, if current thread already has a TPS, or in case of
+ * failure during the creation. 0 if the TPS area was successfully created.
+ */
+int tps_create_sized(size_t size);
+
 /*
  * tps_destroy - Destroy TPS
  *
@@ -70,8 +201,9 @@ int tps_read(size_t offset, size_t length, char *buffer);
  * Write @length bytes located in data buffer @buffer into the current thread's
  * TPS at byte offset @offset.
  *
- * If the current thread's TPS shares a memory page with another thread's TPS,
- * this should trigger a copy-on-write operation before the actual write occurs.
+ * If the current thread's TPS shares memory pages with another thread's TPS,
+ * this should trigger a copy-on-write operation of the written pages before the
+ * actual write occurs.
  *
  * Return: -1 if current thread doesn't have a TPS, or if the writing operation
  * is out of bound, or if @buffer is NULL, or in case of failure. 0 if the TPS
@@ -79,13 +211,80 @@ int tps_read(size_t offset, size_t length, char *buffer);
  */
 int tps_write(size_t offset, size_t length, char *buffer);
 
+/*
+ * tps_readv - Read segments from TPS
+ * @iov: Array of segments to read
+ * @iovcnt: Number of segments in @iov
+ *
+ * Read each of the @iovcnt segments described by @iov from the current
+ * thread's TPS into its data buffer, as if by as many calls to tps_read() but
+ * at the cost of a single one.
+ *
+ * Return: -1 if current thread doesn't have a TPS, if @iov is NULL or @iovcnt
+ * is not positive, if any segment is out of bound or has a NULL buffer, or in
+ * case of internal failure. In that case, no segment is read. 0 if the TPS
+ * was successfully read from.
+ */
+int tps_readv(const struct tps_iovec *iov, int iovcnt);
+
+/*
+ * tps_writev - Write segments to TPS
+ * @iov: Array of segments to write
+ * @iovcnt: Number of segments in @iov
+ *
+ * Write each of the @iovcnt segments described by @iov from its data buffer
+ * into the current thread's TPS, in order, as if by as many calls to
+ * tps_write() but at the cost of a single one.
+ *
+ * Return: -1 if current thread doesn't have a TPS, if @iov is NULL or @iovcnt
+ * is not positive, if any segment is out of bound or has a NULL buffer, or in
+ * case of failure. In that case, no segment is written. 0 if the TPS was
+ * successfully written to.
+ */
+int tps_writev(const struct tps_iovec *iov, int iovcnt);
+
+/*
+ * tps_map - Map TPS for direct access
+ * @offset: Offset in the TPS the returned pointer points to
+ * @length: Length of the data the caller intends to access
+ * @write: Whether the caller intends to write to the TPS
+ *
+ * Give the current thread direct access to its TPS until it calls
+ * tps_unmap(), so that it can read, or write if @write is different than 0,
+ * the TPS in place rather than through tps_read() and tps_write(). If the
+ * current thread's TPS shares memory pages with another thread's TPS, the
+ * pages between @offset and @offset + @length are copied right away when
+ * @write is different than 0, any other one on the first write to it.
+ *
+ * While its TPS is mapped, the current thread cannot call tps_read(),
+ * tps_write() or tps_destroy(), nor map its TPS again. Mapping the TPS does
+ * not give access to the TPS of other threads, but like tps_read() and
+ * tps_write() with mprotect(), it may give other threads access to it.
+ *
+ * Return: Pointer to byte @offset of the TPS. NULL if current thread doesn't
+ * have a TPS, if it is already mapped, if @offset and @length are out of
+ * bound, or in case of failure.
+ */
+void *tps_map(size_t offset, size_t length, int write);
+
+/*
+ * tps_unmap - Unmap TPS
+ *
+ * Take back the direct access to the current thread's TPS given by tps_map().
+ *
+ * Return: -1 if current thread's TPS is not mapped. 0 if the TPS was
+ * successfully unmapped.
+ */
+int tps_unmap(void);
+
 /*
  * tps_clone - Clone TPS
  * @tid: TID of the thread to clone
  *
  * Clone thread @tid's TPS. In the first phase, the cloned TPS's content should
  * copied directly. In the last phase, the new TPS should not copy the cloned
- * TPS's content but should refer to the same memory page.
+ * TPS's content but should refer to the same memory pages. The new TPS has the
+ * same size as the cloned one.
  *
  * Return: -1 if thread @tid doesn't have a TPS, or if current thread already
  * has a TPS, or in case of failure. 0 is TPS was successfully cloned.
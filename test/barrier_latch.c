@@ -0,0 +1,183 @@
+/*
+ * Barrier and latch test
+ *
+ * Threads go through phases separated by a barrier, each writing the number
+ * of the phase in its slot of a table, then checking after the barrier that
+ * all the slots hold it, and before the next write that no thread is still
+ * reading. Exactly one thread must be told it completed each phase.
+ *
+ * Then counters count a latch down once per round, which the main thread
+ * waits on before arming it again and releasing them into the next round with
+ * another latch. Check that a latch releases all its waiters at once, and the
+ * errors of both primitives.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <barrier.h>
+
+#define THREADS		16
+#define PHASES		500
+#define ROUNDS		200
+#define WAITERS		4
+
+static barrier_t barrier;
+static int slots[THREADS];
+static atomic_int serials[PHASES];
+
+static void *phases(void *arg)
+{
+	long self = (long)arg;
+	int phase, i, ret;
+
+	for (phase = 0; phase < PHASES; phase++) {
+		slots[self] = phase;
+
+		ret = barrier_wait(barrier);
+		assert(ret == 0 || ret == BARRIER_SERIAL_THREAD);
+		if (ret == BARRIER_SERIAL_THREAD)
+			atomic_fetch_add(&serials[phase], 1);
+
+		for (i = 0; i < THREADS; i++)
+			assert(slots[i] == phase);
+
+		/* Nobody writes the next phase before all checked this one */
+		barrier_wait(barrier);
+	}
+
+	return NULL;
+}
+
+static void *lone(void *arg)
+{
+	assert(barrier_wait(barrier) >= 0);
+
+	return NULL;
+}
+
+static latch_t done, next[2];
+static atomic_int counted, released;
+
+static void *counter(void *arg)
+{
+	int round;
+
+	for (round = 0; round < ROUNDS; round++) {
+		atomic_fetch_add(&counted, 1);
+		assert(latch_countdown(done, 1) == 0);
+		latch_wait(next[round % 2]);
+	}
+
+	return NULL;
+}
+
+static void *waiter(void *arg)
+{
+	latch_wait(done);
+	atomic_fetch_add(&released, 1);
+
+	return NULL;
+}
+
+static void rounds(void)
+{
+	pthread_t tids[THREADS], waiters[WAITERS];
+	int round, i;
+
+	done = latch_create(THREADS);
+	next[0] = latch_create(1);
+	next[1] = latch_create(1);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tids[i], NULL, counter, NULL);
+
+	for (round = 0; round < ROUNDS; round++) {
+		latch_wait(done);
+		assert(atomic_load(&counted) == THREADS * (round + 1));
+
+		/*
+		 * Counters wait for next before counting down again, so done can
+		 * be armed again; rounds alternate between two next latches, as a
+		 * counter may not have started waiting on the one opened last
+		 */
+		assert(latch_countdown(done, 1) == -1);
+		assert(latch_reset(done, THREADS) == 0);
+		assert(latch_reset(done, THREADS) == -1);
+		assert(latch_reset(next[round % 2], 1) == -1);
+		if (round > 0)
+			assert(latch_reset(next[(round + 1) % 2], 1) == 0);
+		assert(latch_countdown(next[round % 2], 1) == 0);
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(tids[i], NULL);
+
+	/* Waiters blocked on the latch are all released when it opens */
+	for (i = 0; i < WAITERS; i++)
+		pthread_create(&waiters[i], NULL, waiter, NULL);
+	usleep(10000);
+	assert(atomic_load(&released) == 0);
+	assert(latch_destroy(done) == -1);
+	assert(latch_countdown(done, THREADS + 1) == -1);
+	assert(latch_countdown(done, THREADS) == 0);
+	for (i = 0; i < WAITERS; i++)
+		pthread_join(waiters[i], NULL);
+	assert(atomic_load(&released) == WAITERS);
+
+	/* An open latch does not block */
+	assert(latch_wait(done) == 0);
+	assert(latch_destroy(done) == 0);
+	assert(latch_destroy(next[0]) == 0);
+	assert(latch_destroy(next[1]) == 0);
+}
+
+int main(void)
+{
+	pthread_t tids[THREADS];
+	latch_t open;
+	long i;
+
+	assert(barrier_create(0) == NULL);
+	assert(barrier_wait(NULL) == -1 && barrier_destroy(NULL) == -1);
+	assert(latch_countdown(NULL, 1) == -1 && latch_wait(NULL) == -1);
+	assert(latch_reset(NULL, 1) == -1 && latch_destroy(NULL) == -1);
+
+	/* A barrier for one thread never blocks */
+	barrier = barrier_create(1);
+	assert(barrier_wait(barrier) == BARRIER_SERIAL_THREAD);
+	assert(barrier_destroy(barrier) == 0);
+
+	/* A barrier cannot be destroyed while a thread waits on it */
+	barrier = barrier_create(2);
+	pthread_create(&tids[0], NULL, lone, NULL);
+	usleep(10000);
+	assert(barrier_destroy(barrier) == -1);
+	assert(barrier_wait(barrier) >= 0);
+	pthread_join(tids[0], NULL);
+	assert(barrier_destroy(barrier) == 0);
+
+	barrier = barrier_create(THREADS);
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tids[i], NULL, phases, (void*)i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(tids[i], NULL);
+	for (i = 0; i < PHASES; i++)
+		assert(atomic_load(&serials[i]) == 1);
+	assert(barrier_destroy(barrier) == 0);
+	printf("%d threads went through %d phases\n", THREADS, PHASES);
+
+	rounds();
+	printf("%d counters went through %d rounds\n", THREADS, ROUNDS);
+
+	open = latch_create(0);
+	assert(latch_countdown(open, 1) == -1 && latch_countdown(open, 0) == -1);
+	assert(latch_wait(open) == 0);
+	assert(latch_destroy(open) == 0);
+
+	printf("Barriers and latches OK\n");
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Producer/consumer throughput benchmark
+ *
+ * Port of sem_buffer to channels: producers put values in a shared buffer of
+ * BUFFER_SIZE slots, in batches of random sizes, while consumers take them
+ * out. The buffer is either built from three semaphores (empty, full, mutex)
+ * as in sem_buffer, or is a channel. Throughput is measured with 1 producer
+ * and 1 consumer, N producers and 1 consumer, and N producers and M consumers,
+ * and every value produced must be consumed exactly once, in order for each
+ * producer and consumer.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <channel.h>
+#include <sem.h>
+
+#define BUFFER_SIZE	16
+#define MAXCOUNT	200000
+#define MAX_THREADS	4
+
+struct buffer {
+	sem_t empty;
+	sem_t full;
+	sem_t mutex;
+	size_t head, tail;
+	uintptr_t items[BUFFER_SIZE];
+	channel_t channel;
+};
+
+struct worker {
+	pthread_t tid;
+	struct buffer *buffer;
+	unsigned int id, seed;
+	size_t count;
+	unsigned long long sum;
+	uintptr_t last[MAX_THREADS];
+};
+
+static unsigned int maxcount = MAXCOUNT;
+
+#define clamp(x, y) (((x) <= (y)) ? (x) : (y))
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void put(struct buffer *b, uintptr_t item)
+{
+	if (b->channel != NULL) {
+		channel_send(b->channel, (void*)item);
+		return;
+	}
+
+	sem_down(b->full);
+	sem_down(b->mutex);
+	b->items[b->head] = item;
+	b->head = (b->head + 1) % BUFFER_SIZE;
+	sem_up(b->mutex);
+	sem_up(b->empty);
+}
+
+static uintptr_t get(struct buffer *b)
+{
+	uintptr_t item;
+
+	if (b->channel != NULL) {
+		channel_recv(b->channel, (void**)&item);
+		return item;
+	}
+
+	sem_down(b->empty);
+	sem_down(b->mutex);
+	item = b->items[b->tail];
+	b->tail = (b->tail + 1) % BUFFER_SIZE;
+	sem_up(b->mutex);
+	sem_up(b->full);
+	return item;
+}
+
+/* Values encode their producer in their low bits, and are never 0 */
+static void *producer(void *arg)
+{
+	struct worker *w = arg;
+	size_t i, n, value = 1;
+
+	while (value <= w->count) {
+		n = rand_r(&w->seed) % BUFFER_SIZE + 1;
+		n = clamp(n, w->count - value + 1);
+		for (i = 0; i < n; i++, value++)
+			put(w->buffer, value * MAX_THREADS + w->id);
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct worker *w = arg;
+	size_t i, n, out = 0;
+	uintptr_t item;
+
+	while (out < w->count) {
+		n = rand_r(&w->seed) % BUFFER_SIZE + 1;
+		n = clamp(n, w->count - out);
+		for (i = 0; i < n; i++, out++) {
+			item = get(w->buffer);
+
+			/* Values of each producer arrive in order */
+			assert(item > w->last[item % MAX_THREADS]);
+			w->last[item % MAX_THREADS] = item;
+			w->sum += item;
+		}
+	}
+
+	return NULL;
+}
+
+static double run(int channel, unsigned int producers, unsigned int consumers)
+{
+	struct worker prod[MAX_THREADS] = { 0 }, cons[MAX_THREADS] = { 0 };
+	unsigned long long sum = 0, expected = 0;
+	struct buffer b = { 0 };
+	double start, elapsed;
+	unsigned int i;
+
+	if (channel) {
+		b.channel = channel_create(BUFFER_SIZE);
+	} else {
+		b.empty = sem_create(0);
+		b.full = sem_create(BUFFER_SIZE);
+		b.mutex = sem_create(1);
+	}
+
+	for (i = 0; i < producers; i++) {
+		prod[i].buffer = &b;
+		prod[i].id = i;
+		prod[i].seed = 2 + i;
+		prod[i].count = maxcount / producers;
+	}
+	for (i = 0; i < consumers; i++) {
+		cons[i].buffer = &b;
+		cons[i].seed = 1 + i;
+		cons[i].count = maxcount / consumers;
+	}
+
+	start = now_ns();
+	for (i = 0; i < producers; i++)
+		pthread_create(&prod[i].tid, NULL, producer, &prod[i]);
+	for (i = 0; i < consumers; i++)
+		pthread_create(&cons[i].tid, NULL, consumer, &cons[i]);
+	for (i = 0; i < producers; i++)
+		pthread_join(prod[i].tid, NULL);
+	for (i = 0; i < consumers; i++)
+		pthread_join(cons[i].tid, NULL);
+	elapsed = now_ns() - start;
+
+	/* Every value produced was consumed exactly once */
+	for (i = 0; i < consumers; i++)
+		sum += cons[i].sum;
+	for (i = 0; i < producers; i++)
+		expected += prod[i].count * (prod[i].count + 1) / 2 * MAX_THREADS +
+			prod[i].count * i;
+	assert(sum == expected);
+
+	if (channel) {
+		assert(channel_destroy(b.channel) == 0);
+	} else {
+		sem_destroy(b.empty);
+		sem_destroy(b.full);
+		sem_destroy(b.mutex);
+	}
+
+	return maxcount / elapsed * 1e9;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int setups[][2] = {
+		{ 1, 1 }, { MAX_THREADS, 1 }, { MAX_THREADS, MAX_THREADS },
+	};
+	unsigned int i;
+
+	if (argc > 1)
+		maxcount = get_argv(argv[1]);
+	maxcount -= maxcount % MAX_THREADS;
+
+	for (i = 0; i < sizeof(setups) / sizeof(setups[0]); i++) {
+		double sems = run(0, setups[i][0], setups[i][1]);
+		double chan = run(1, setups[i][0], setups[i][1]);
+
+		printf("%u:%u: semaphores %10.0f items/sec, channel %10.0f "
+		       "items/sec\n", setups[i][0], setups[i][1], sems, chan);
+	}
+
+	return 0;
+}
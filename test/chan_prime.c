@@ -0,0 +1,273 @@
+/*
+ * Prime sieve pipeline benchmark
+ *
+ * Port of sem_prime to channels: a source thread sends numbers from 2 to max
+ * down a pipeline of filter threads, one per prime, which drop the multiples
+ * of their prime, and a sink thread gets primes from the end of the pipeline.
+ * Each stage of the pipeline is either a pair of semaphores around a shared
+ * value as in sem_prime, an unbuffered channel, or an unbuffered channel
+ * through which numbers are sent in batches of up to BATCH.
+ *
+ * Filters are only added for primes up to the square root of max, which is
+ * enough to drop every composite number, so that the pipeline stays within
+ * the number of threads a process can have for large values of max. In batch
+ * mode, numbers of a batch following a new prime have not gone through its
+ * filter yet, so the sink checks them against the primes of their batch.
+ *
+ * Runs up to MAXPRIME by default, quick enough for a test; `chan_prime.x -b`
+ * runs the benchmark setting, up to BENCH_MAXPRIME, and `chan_prime.x N` up
+ * to N, at least 2.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <channel.h>
+#include <sem.h>
+
+#define MAXPRIME	20000
+#define BENCH_MAXPRIME	1000000
+#define BATCH		64
+
+enum mode { SEMAPHORES, RENDEZVOUS, BATCHED };
+
+struct pipe {
+	uintptr_t value;
+	sem_t produce;
+	sem_t consume;
+	channel_t channel;
+};
+
+struct filter {
+	struct pipe *left;
+	struct pipe *right;
+	uintptr_t prime;
+	pthread_t tid;
+	struct filter *next;
+};
+
+static unsigned int max = MAXPRIME;
+static enum mode mode;
+static atomic_ulong hops;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct pipe *pipe_create(void)
+{
+	struct pipe *p = calloc(1, sizeof(*p));
+
+	if (mode == SEMAPHORES) {
+		p->produce = sem_create(0);
+		p->consume = sem_create(0);
+	} else {
+		p->channel = channel_create(0);
+	}
+	return p;
+}
+
+static void pipe_destroy(struct pipe *p)
+{
+	if (mode == SEMAPHORES) {
+		sem_destroy(p->produce);
+		sem_destroy(p->consume);
+	} else {
+		assert(channel_destroy(p->channel) == 0);
+	}
+	free(p);
+}
+
+/* Sends count values, the last one being 0 at the end of the numbers */
+static void put(struct pipe *p, uintptr_t *values, size_t count)
+{
+	size_t i;
+
+	if (mode == BATCHED) {
+		channel_send_n(p->channel, (void**)values, count);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (mode == RENDEZVOUS) {
+			channel_send(p->channel, (void*)values[i]);
+		} else {
+			p->value = values[i];
+			sem_up(p->consume);
+			sem_down(p->produce);
+		}
+	}
+}
+
+/* Receives one value, or up to BATCH values in batch mode */
+static size_t get(struct pipe *p, uintptr_t *values)
+{
+	if (mode == BATCHED)
+		return channel_recv_n(p->channel, (void**)values, BATCH);
+
+	if (mode == RENDEZVOUS) {
+		channel_recv(p->channel, (void**)values);
+	} else {
+		sem_down(p->consume);
+		values[0] = p->value;
+		sem_up(p->produce);
+	}
+	return 1;
+}
+
+static void *source(void *arg)
+{
+	struct pipe *p = arg;
+	uintptr_t values[BATCH];
+	size_t n = 0, batch = mode == BATCHED ? BATCH : 1;
+	uintptr_t i;
+
+	for (i = 2; i <= max + 1; i++) {
+		values[n++] = i <= max ? i : 0;
+		if (n == batch || i == max + 1) {
+			put(p, values, n);
+			n = 0;
+		}
+	}
+
+	hops += max;
+	return NULL;
+}
+
+static void *filter(void *arg)
+{
+	struct filter *f = arg;
+	uintptr_t values[BATCH];
+	unsigned long count = 0;
+	size_t i, n, kept;
+	int done = 0;
+
+	while (!done) {
+		n = get(f->left, values);
+		for (i = kept = 0; i < n; i++) {
+			if (values[i] == 0 || values[i] % f->prime != 0)
+				values[kept++] = values[i];
+			done |= values[i] == 0;
+		}
+		if (kept > 0)
+			put(f->right, values, kept);
+		count += kept;
+	}
+
+	hops += count;
+	return NULL;
+}
+
+/* Returns the number of primes up to max */
+static unsigned long sink(void)
+{
+	uintptr_t values[BATCH], found[BATCH];
+	struct filter *f, *f_head = NULL;
+	struct pipe *first, *p;
+	unsigned long primes = 0;
+	size_t i, j, n, nfound;
+	pthread_t tid;
+	int done = 0;
+
+	first = p = pipe_create();
+	pthread_create(&tid, NULL, source, p);
+
+	while (!done) {
+		n = get(p, values);
+		for (i = nfound = 0; i < n && values[i] != 0; i++) {
+			/* Drops multiples of the primes found earlier in the batch */
+			for (j = 0; j < nfound; j++)
+				if (values[i] % found[j] == 0)
+					break;
+			if (j < nfound)
+				continue;
+
+			primes++;
+			if (values[i] > max / values[i])
+				continue;
+			found[nfound++] = values[i];
+
+			f = malloc(sizeof(*f));
+			f->left = p;
+			f->right = p = pipe_create();
+			f->prime = values[i];
+			f->next = f_head;
+			f_head = f;
+			pthread_create(&f->tid, NULL, filter, f);
+		}
+		done = i < n;
+	}
+
+	pthread_join(tid, NULL);
+	pipe_destroy(first);
+	while (f_head) {
+		f = f_head;
+		pthread_join(f->tid, NULL);
+		pipe_destroy(f->right);
+		f_head = f->next;
+		free(f);
+	}
+
+	return primes;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret;
+
+	if (!strcmp(argv, "-b"))
+		return BENCH_MAXPRIME;
+
+	ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+
+	/* The source only ends the pipeline after sending a number */
+	if (ret < 2) {
+		fprintf(stderr, "max must be at least 2\n");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "semaphore pairs", "rendezvous",
+				       "rendezvous batched" };
+	unsigned long primes, expected = 0;
+	double start, elapsed;
+
+	if (argc > 1)
+		max = get_argv(argv[1]);
+
+	for (mode = SEMAPHORES; mode <= BATCHED; mode++) {
+		hops = 0;
+		start = now_ns();
+		primes = sink();
+		elapsed = now_ns() - start;
+
+		/* Every mode finds the same primes */
+		if (mode == SEMAPHORES)
+			expected = primes;
+		assert(primes == expected);
+
+		printf("%-18s: %lu primes up to %u, %lu hops, %6.1f ns/hop\n",
+		       names[mode], primes, max, (unsigned long)hops,
+		       elapsed / hops);
+	}
+
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Queue benchmark
+ *
+ * Compare queue_t, which allocates a node per item, with the intrusive
+ * queue_list, which links items through a queue_link embedded in them. Both
+ * hold DEPTH items while items are dequeued and enqueued again, then while
+ * items anywhere in the queue are deleted and enqueued again, as a waiter
+ * giving up on a semaphore would.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <queue.h>
+
+#define ITERATIONS	1000000
+#define DEPTH		1000
+
+struct item {
+	struct queue_link link;
+	int value;
+};
+
+static struct item items[DEPTH];
+static unsigned int iterations = ITERATIONS;
+static unsigned int seed;
+
+/* Picks items in pseudo-random order, so that they are anywhere in the queue */
+static unsigned int pick(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % DEPTH;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_queue(void)
+{
+	queue_t queue = queue_create();
+	double start, fifo_ns, delete_ns;
+	struct item *item;
+	unsigned int i;
+
+	for (i = 0; i < DEPTH; i++)
+		queue_enqueue(queue, &items[i]);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		queue_dequeue(queue, (void**)&item);
+		queue_enqueue(queue, item);
+	}
+	fifo_ns = (now_ns() - start) / iterations;
+
+	/* The order of items is rotated, but they are all still queued */
+	queue_dequeue(queue, (void**)&item);
+	assert(item == &items[iterations % DEPTH]);
+	queue_enqueue(queue, item);
+
+	seed = 1;
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		item = &items[pick()];
+		queue_delete(queue, item);
+		queue_enqueue(queue, item);
+	}
+	delete_ns = (now_ns() - start) / iterations;
+	assert(queue_length(queue) == DEPTH);
+
+	printf("queue_t:    enqueue+dequeue %6.1f ns, delete+enqueue %8.1f ns\n",
+	       fifo_ns, delete_ns);
+
+	while (queue_dequeue(queue, (void**)&item) == 0)
+		;
+	queue_destroy(queue);
+}
+
+static void bench_list(void)
+{
+	struct queue_list list = QUEUE_LIST_INIT;
+	double start, fifo_ns, delete_ns;
+	struct queue_link *link;
+	struct item *item;
+	unsigned int i;
+
+	for (i = 0; i < DEPTH; i++)
+		queue_list_enqueue(&list, &items[i].link);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		link = queue_list_dequeue(&list);
+		queue_list_enqueue(&list, link);
+	}
+	fifo_ns = (now_ns() - start) / iterations;
+
+	/* The order of items is rotated, but they are all still queued */
+	item = queue_entry(queue_list_first(&list), struct item, link);
+	assert(item == &items[iterations % DEPTH]);
+
+	seed = 1;
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		item = &items[pick()];
+		queue_list_delete(&list, &item->link);
+		queue_list_enqueue(&list, &item->link);
+	}
+	delete_ns = (now_ns() - start) / iterations;
+	assert(list.length == DEPTH);
+
+	printf("queue_list: enqueue+dequeue %6.1f ns, delete+enqueue %8.1f ns\n",
+	       fifo_ns, delete_ns);
+
+	while (queue_list_dequeue(&list) != NULL)
+		;
+	assert(queue_list_first(&list) == NULL && list.length == 0);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		iterations = get_argv(argv[1]);
+
+	printf("%d items queued:\n", DEPTH);
+	bench_queue();
+	bench_list();
+
+	return 0;
+}
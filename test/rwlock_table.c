@@ -0,0 +1,199 @@
+/*
+ * Reader-writer lock test
+ *
+ * Threads look entries of a shared table up, and one lookup in WRITE_EVERY
+ * updates an entry instead, protected in turn by a semaphore of count 1 and
+ * by reader-writer locks preferring readers or writers. Each entry holds a
+ * value and its opposite, which readers must always find consistent. For each
+ * number of threads, print the lookups per second with each lock.
+ *
+ * Then check which of a new reader and a waiting writer gets the lock first
+ * with each preference, and that writers can take the lock again.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rwlock.h>
+#include <sem.h>
+
+#define ENTRIES		256
+#define LOOKUPS		200000
+#define WRITE_EVERY	100
+#define MAX_THREADS	16
+
+enum kind { SEMAPHORE, PREFER_READERS, PREFER_WRITERS, KINDS };
+
+static const char *names[KINDS] = {
+	"semaphore", "rwlock (readers)", "rwlock (writers)"
+};
+
+static struct entry {
+	long value;
+	long opposite;
+} table[ENTRIES];
+
+static enum kind kind;
+static sem_t mutex;
+static rwlock_t lock;
+static int per_thread;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void take(int write)
+{
+	if (kind == SEMAPHORE)
+		sem_down(mutex);
+	else if (write)
+		rwlock_wrlock(lock);
+	else
+		rwlock_rdlock(lock);
+}
+
+static void release(void)
+{
+	if (kind == SEMAPHORE)
+		sem_up(mutex);
+	else
+		rwlock_unlock(lock);
+}
+
+static void *worker(void *arg)
+{
+	unsigned int seed = (unsigned long)arg;
+	struct entry *entry;
+	int i;
+
+	for (i = 0; i < per_thread; i++) {
+		entry = &table[rand_r(&seed) % ENTRIES];
+
+		if (i % WRITE_EVERY == 0) {
+			take(1);
+			entry->value++;
+			entry->opposite--;
+			release();
+		} else {
+			take(0);
+			assert(entry->value + entry->opposite == 0);
+			release();
+		}
+	}
+
+	return NULL;
+}
+
+static void lookups(int threads)
+{
+	pthread_t tids[MAX_THREADS];
+	double start, elapsed;
+	int i;
+
+	per_thread = LOOKUPS / threads;
+	printf("%2d threads:", threads);
+
+	for (kind = 0; kind < KINDS; kind++) {
+		mutex = sem_create(1);
+		lock = rwlock_create(kind == PREFER_WRITERS ?
+				     RWLOCK_PREFER_WRITERS : RWLOCK_PREFER_READERS);
+
+		start = now_ns();
+		for (i = 0; i < threads; i++)
+			pthread_create(&tids[i], NULL, worker, (void*)(long)i);
+		for (i = 0; i < threads; i++)
+			pthread_join(tids[i], NULL);
+		elapsed = now_ns() - start;
+
+		assert(sem_destroy(mutex) == 0);
+		assert(rwlock_destroy(lock) == 0);
+		printf(" %s %9.0f/s", names[kind], per_thread * threads * 1e9 / elapsed);
+	}
+
+	printf("\n");
+}
+
+static atomic_int writer_done, reader_done;
+
+static void *late_writer(void *arg)
+{
+	/* Takes the lock again, and releases it as many times */
+	assert(rwlock_wrlock(lock) == 0);
+	assert(rwlock_wrlock(lock) == 0);
+	atomic_store(&writer_done, 1);
+	assert(rwlock_unlock(lock) == 0);
+	assert(rwlock_unlock(lock) == 0);
+
+	return NULL;
+}
+
+static void *late_reader(void *arg)
+{
+	assert(rwlock_rdlock(lock) == 0);
+	atomic_store(&reader_done, 1 + atomic_load(&writer_done));
+	assert(rwlock_unlock(lock) == 0);
+
+	return NULL;
+}
+
+/*
+ * While a reader holds the lock, a writer waits for it, then another reader
+ * comes: it must get in before the writer only when readers are preferred
+ */
+static void preference(enum rwlock_pref pref)
+{
+	pthread_t writer, reader;
+
+	lock = rwlock_create(pref);
+	atomic_store(&writer_done, 0);
+	atomic_store(&reader_done, 0);
+
+	assert(rwlock_rdlock(lock) == 0);
+	pthread_create(&writer, NULL, late_writer, NULL);
+	usleep(10000);
+	assert(rwlock_destroy(lock) == -1);
+
+	pthread_create(&reader, NULL, late_reader, NULL);
+	usleep(10000);
+	if (pref == RWLOCK_PREFER_READERS)
+		assert(atomic_load(&reader_done) == 1);
+	else
+		assert(atomic_load(&reader_done) == 0);
+	assert(atomic_load(&writer_done) == 0);
+
+	assert(rwlock_unlock(lock) == 0);
+	pthread_join(writer, NULL);
+	pthread_join(reader, NULL);
+
+	/* With writers preferred, the reader only got in after the writer */
+	assert(atomic_load(&reader_done) ==
+	       (pref == RWLOCK_PREFER_READERS ? 1 : 2));
+	assert(rwlock_destroy(lock) == 0);
+}
+
+int main(void)
+{
+	int threads;
+
+	assert(rwlock_create(2) == NULL);
+	assert(rwlock_rdlock(NULL) == -1 && rwlock_wrlock(NULL) == -1);
+	assert(rwlock_unlock(NULL) == -1 && rwlock_destroy(NULL) == -1);
+
+	for (threads = 1; threads <= MAX_THREADS; threads *= 4)
+		lookups(threads);
+
+	preference(RWLOCK_PREFER_READERS);
+	preference(RWLOCK_PREFER_WRITERS);
+
+	printf("Reader-writer locks OK\n");
+	return 0;
+}
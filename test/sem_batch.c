@@ -0,0 +1,176 @@
+/*
+ * Batched semaphore operations test
+ *
+ * A thread taking several resources at once keeps the available ones and
+ * waits for the others, and must not be overtaken by threads taking single
+ * resources meanwhile. Then producers and consumers move ITEMS items through
+ * a pair of semaphores, first one item at a time, then in batches of BATCH
+ * items with sem_up_n() and sem_down_n(), and the time per item is compared.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+
+#define ITEMS		1000000
+#define BATCH		64
+#define PRODUCERS	2
+#define CONSUMERS	2
+
+static sem_t empty, full;
+static unsigned int items = ITEMS;
+static int batched;
+static atomic_int taken;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *batch(void *arg)
+{
+	sem_t sem = arg;
+
+	sem_down_n(sem, 5);
+	taken += 5;
+	return NULL;
+}
+
+static void *single(void *arg)
+{
+	sem_t sem = arg;
+
+	sem_down(sem);
+	taken += 1;
+	return NULL;
+}
+
+static void order(void)
+{
+	sem_t sem = sem_create(2);
+	struct timespec wait = { 0, 10 * 1000000L };
+	pthread_t tid1, tid2;
+	int value;
+
+	assert(sem_down_n(NULL, 1) == -1);
+	assert(sem_up_n(NULL, 1) == -1);
+	assert(sem_down_n(sem, (size_t)INT_MAX + 1) == -1);
+	assert(sem_down_n(sem, 0) == 0 && sem_up_n(sem, 0) == 0);
+
+	/* The batch keeps the 2 resources available and waits for 3 more */
+	pthread_create(&tid1, NULL, batch, sem);
+	nanosleep(&wait, NULL);
+	sem_getvalue(sem, &value);
+	assert(value == -3);
+
+	/* A single resource taken afterwards must wait behind the batch */
+	pthread_create(&tid2, NULL, single, sem);
+	nanosleep(&wait, NULL);
+	sem_getvalue(sem, &value);
+	assert(value == -4);
+
+	sem_up(sem);
+	sem_up(sem);
+	nanosleep(&wait, NULL);
+	sem_getvalue(sem, &value);
+	assert(value == -2 && taken == 0);
+	sem_up_n(sem, 4);
+	pthread_join(tid1, NULL);
+	pthread_join(tid2, NULL);
+
+	sem_getvalue(sem, &value);
+	assert(value == 2 && taken == 6);
+	assert(sem_destroy(sem) == 0);
+	printf("order OK!\n");
+}
+
+static void *producer(void *arg)
+{
+	unsigned int i, n = batched ? BATCH : 1;
+
+	for (i = 0; i < items / PRODUCERS; i += n) {
+		sem_down_n(empty, n);
+		sem_up_n(full, n);
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	unsigned int i, n = batched ? BATCH : 1;
+
+	for (i = 0; i < items / CONSUMERS; i += n) {
+		sem_down_n(full, n);
+		sem_up_n(empty, n);
+	}
+
+	return NULL;
+}
+
+static double transfer(void)
+{
+	pthread_t tids[PRODUCERS + CONSUMERS];
+	double start;
+	int i, value;
+
+	empty = sem_create(4 * BATCH);
+	full = sem_create(0);
+
+	start = now_ns();
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_create(&tids[i], NULL, producer, NULL);
+	for (i = 0; i < CONSUMERS; i++)
+		pthread_create(&tids[PRODUCERS + i], NULL, consumer, NULL);
+	for (i = 0; i < PRODUCERS + CONSUMERS; i++)
+		pthread_join(tids[i], NULL);
+	start = (now_ns() - start) / items;
+
+	/* Every item produced was consumed */
+	sem_getvalue(empty, &value);
+	assert(value == 4 * BATCH);
+	sem_getvalue(full, &value);
+	assert(value == 0);
+
+	sem_destroy(empty);
+	sem_destroy(full);
+	return start;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	double single_ns, batch_ns;
+
+	if (argc > 1)
+		items = get_argv(argv[1]);
+	items -= items % (BATCH * PRODUCERS * CONSUMERS);
+
+	order();
+
+	single_ns = transfer();
+	batched = 1;
+	batch_ns = transfer();
+	printf("%u items: %.1f ns/item one at a time, %.1f ns/item in "
+	       "batches of %d\n", items, single_ns, batch_ns, BATCH);
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Semaphore microbenchmark
+ *
+ * Spawn a growing number of threads, each taking and releasing its own
+ * semaphore in a loop. No thread ever has to wait, so the total number of
+ * operations per second should grow with the number of threads, up to the
+ * number of cores.
+ *
+ * Then spawn a growing number of independent producer/consumer pairs, each
+ * handing items over through its own two semaphores, so that threads keep
+ * blocking and waking each other. As no two pairs share a lock, the total
+ * number of hand-offs per second should also grow with the number of pairs.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+#define ITERATIONS	1000000
+#define MAX_THREADS	4
+#define HANDOFFS	(ITERATIONS / 10)
+
+struct pair {
+	sem_t empty;
+	sem_t full;
+};
+
+static unsigned int iterations = ITERATIONS;
+static unsigned int handoffs = HANDOFFS;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Takes and releases a private semaphore */
+static void *uncontended(void *arg)
+{
+	sem_t sem = sem_create(1);
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		sem_down(sem);
+		sem_up(sem);
+	}
+
+	sem_destroy(sem);
+
+	return NULL;
+}
+
+/* Producer: waits for an empty slot and fills it */
+static void *producer(void *arg)
+{
+	struct pair *p = arg;
+	unsigned int i;
+
+	for (i = 0; i < handoffs; i++) {
+		sem_down(p->empty);
+		sem_up(p->full);
+	}
+
+	return NULL;
+}
+
+/* Consumer: waits for a full slot and empties it */
+static void *consumer(void *arg)
+{
+	struct pair *p = arg;
+	unsigned int i;
+
+	for (i = 0; i < handoffs; i++) {
+		sem_down(p->full);
+		sem_up(p->empty);
+	}
+
+	return NULL;
+}
+
+static void run_pairs(unsigned int npairs)
+{
+	struct pair *pairs = malloc(npairs * sizeof(struct pair));
+	pthread_t *tids = malloc(2 * npairs * sizeof(pthread_t));
+	double start, elapsed;
+	unsigned int i;
+
+	for (i = 0; i < npairs; i++) {
+		pairs[i].empty = sem_create(1);
+		pairs[i].full = sem_create(0);
+	}
+
+	start = now_ns();
+	for (i = 0; i < npairs; i++) {
+		pthread_create(&tids[2 * i], NULL, producer, &pairs[i]);
+		pthread_create(&tids[2 * i + 1], NULL, consumer, &pairs[i]);
+	}
+	for (i = 0; i < 2 * npairs; i++)
+		pthread_join(tids[i], NULL);
+	elapsed = now_ns() - start;
+
+	printf("%3u pairs: %8.1f ns/hand-off, %12.0f hand-offs/sec\n", npairs,
+	       elapsed / handoffs, 1.0 * handoffs * npairs / elapsed * 1e9);
+
+	for (i = 0; i < npairs; i++) {
+		sem_destroy(pairs[i].empty);
+		sem_destroy(pairs[i].full);
+	}
+	free(tids);
+	free(pairs);
+}
+
+static void run(unsigned int nthreads)
+{
+	pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+	double start, elapsed;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&tids[i], NULL, uncontended, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	elapsed = now_ns() - start;
+
+	/* One down and one up per iteration */
+	printf("%3u threads: %8.1f ns/op, %12.0f ops/sec\n", nthreads,
+	       elapsed / iterations / 2,
+	       2.0 * iterations * nthreads / elapsed * 1e9);
+
+	free(tids);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nthreads, max = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (argc > 1)
+		iterations = get_argv(argv[1]);
+	if (argc > 2)
+		handoffs = get_argv(argv[2]);
+	if (max < MAX_THREADS)
+		max = MAX_THREADS;
+
+	printf("Uncontended sem_down()/sem_up(), %ld cores:\n",
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	for (nthreads = 1; nthreads <= max; nthreads *= 2)
+		run(nthreads);
+
+	printf("Producer/consumer pairs:\n");
+	for (nthreads = 1; nthreads <= 2 * max; nthreads *= 2)
+		run_pairs(nthreads);
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Fan-in wakeup test
+ *
+ * Many producer threads release items to a few consumer threads through a
+ * single semaphore, yielding the processor after each one, so that consumers
+ * keep waiting and being woken up. Every item must be consumed exactly once.
+ * For each number of producers, print the items per second, and the voluntary
+ * context switches per item, which count the times a thread slept, including
+ * woken threads waiting for the lock of the semaphore the waking thread still
+ * held.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <sem.h>
+
+#define CONSUMERS	4
+#define ITEMS		200000
+#define MAX_PRODUCERS	64
+
+static sem_t items;
+static atomic_int consumed;
+static int per_producer;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long sleeps(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw;
+}
+
+static void *producer(void *arg)
+{
+	int i;
+
+	/* Lets consumers run, and drain the items, between releases */
+	for (i = 0; i < per_producer; i++) {
+		sem_up(items);
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	int total = *(int *)arg;
+
+	while (atomic_fetch_add(&consumed, 1) < total)
+		sem_down(items);
+
+	return NULL;
+}
+
+static void fan_in(int producers)
+{
+	pthread_t ptids[MAX_PRODUCERS], ctids[CONSUMERS];
+	int i, total, value;
+	double start, elapsed;
+	long ctx;
+
+	items = sem_create(0);
+	per_producer = ITEMS / producers;
+	total = per_producer * producers;
+	atomic_store(&consumed, 0);
+
+	ctx = sleeps();
+	start = now_ns();
+	for (i = 0; i < CONSUMERS; i++)
+		pthread_create(&ctids[i], NULL, consumer, &total);
+	for (i = 0; i < producers; i++)
+		pthread_create(&ptids[i], NULL, producer, NULL);
+	for (i = 0; i < producers; i++)
+		pthread_join(ptids[i], NULL);
+	for (i = 0; i < CONSUMERS; i++)
+		pthread_join(ctids[i], NULL);
+	elapsed = now_ns() - start;
+
+	/* Each consumer stops after one failed claim */
+	assert(atomic_load(&consumed) == total + CONSUMERS);
+	assert(sem_getvalue(items, &value) == 0 && value == 0);
+	assert(sem_destroy(items) == 0);
+
+	printf("%2d:%d %10.0f items/sec, %.3f sleeps/item\n", producers,
+	       CONSUMERS, total * 1e9 / elapsed,
+	       (double)(sleeps() - ctx) / total);
+}
+
+int main(void)
+{
+	int producers;
+
+	for (producers = 1; producers <= MAX_PRODUCERS; producers *= 4)
+		fan_in(producers);
+
+	printf("Fan-in OK\n");
+	return 0;
+}
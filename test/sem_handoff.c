@@ -0,0 +1,211 @@
+/*
+ * Hand-off and barging semaphore test
+ *
+ * THREADS threads take a semaphore of count 1 as a lock, hold it for a short
+ * while, and release it, in both modes. Mutual exclusion must hold and no
+ * round must be lost. For each mode, print the throughput, the gap between a
+ * release and the next acquisition, and the latency of acquisitions: with
+ * hand-off, the releasing thread cannot take the semaphore back and each
+ * hand-over waits for the woken thread to run, while with barging the
+ * semaphore stays busy but some acquisitions wait much longer.
+ *
+ * Then check that timed waits in barging mode give up without taking a
+ * resource, that sem_getvalue() counts the waiting threads, and that a waiter
+ * needing several resources does not keep one behind it from taking one.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+#define THREADS		4
+#define ROUNDS		20000
+#define HOLD_SPINS	200
+#define WORK_SPINS	400
+#define TIMEOUT_MS	5
+
+static sem_t sem;
+static atomic_int inside;
+static long last_release;
+static long latencies[THREADS * ROUNDS];
+static long gaps[THREADS * ROUNDS];
+static int rounds;
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static struct timespec deadline(long ns)
+{
+	struct timespec ts;
+
+	ns += now_ns();
+	ts.tv_sec = ns / 1000000000L;
+	ts.tv_nsec = ns % 1000000000L;
+	return ts;
+}
+
+static void spin(int spins)
+{
+	volatile int i;
+
+	for (i = 0; i < spins; i++)
+		;
+}
+
+static void *worker(void *arg)
+{
+	long start, acquired;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		start = now_ns();
+		sem_down(sem);
+		acquired = now_ns();
+		assert(atomic_fetch_add(&inside, 1) == 0);
+
+		/* Guarded by the semaphore */
+		latencies[rounds] = acquired - start;
+		gaps[rounds] = last_release ? acquired - last_release : 0;
+		rounds++;
+		spin(HOLD_SPINS);
+
+		atomic_fetch_sub(&inside, 1);
+		last_release = now_ns();
+		sem_up(sem);
+		spin(WORK_SPINS);
+	}
+
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void contend(enum sem_mode mode, const char *name)
+{
+	pthread_t tids[THREADS];
+	long start, elapsed, gap = 0;
+	int i, value;
+
+	sem = sem_create_mode(1, mode);
+	assert(sem != NULL);
+	rounds = 0;
+	last_release = 0;
+
+	start = now_ns();
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tids[i], NULL, worker, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(tids[i], NULL);
+	elapsed = now_ns() - start;
+
+	assert(rounds == THREADS * ROUNDS);
+	assert(sem_getvalue(sem, &value) == 0 && value == 1);
+	assert(sem_destroy(sem) == 0);
+
+	for (i = 0; i < rounds; i++)
+		gap += gaps[i];
+	qsort(latencies, rounds, sizeof(long), compare);
+	printf("%-8s %8.0f rounds/s, hand-over %6.0f ns, "
+	       "latency p50 %6ld p99 %8ld max %9ld ns\n", name,
+	       rounds * 1e9 / elapsed, (double)gap / rounds,
+	       latencies[rounds / 2], latencies[rounds * 99 / 100],
+	       latencies[rounds - 1]);
+}
+
+static void *timed_waiter(void *arg)
+{
+	struct timespec abstime = deadline(TIMEOUT_MS * 1000000L);
+
+	assert(sem_timeddown(sem, &abstime) == -1);
+	return NULL;
+}
+
+static void *waiter(void *arg)
+{
+	sem_down(sem);
+	return NULL;
+}
+
+static void *batch_waiter(void *arg)
+{
+	assert(sem_down_n(sem, 2) == 0);
+	return NULL;
+}
+
+/* Waits until @count threads wait on sem */
+static void wait_sleepers(int count)
+{
+	int value;
+
+	do {
+		usleep(1000);
+		sem_getvalue(sem, &value);
+	} while (value > -count);
+}
+
+/* Waiting threads are counted, and those timing out take no resource */
+static void barging_waits(void)
+{
+	pthread_t tids[THREADS];
+	int i, value;
+
+	sem = sem_create_mode(0, SEM_BARGING);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tids[i], NULL, timed_waiter, NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(tids[i], NULL);
+	assert(sem_getvalue(sem, &value) == 0 && value == 0);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tids[i], NULL, waiter, NULL);
+	wait_sleepers(THREADS);
+	assert(sem_destroy(sem) == -1);
+
+	sem_up_n(sem, THREADS + 1);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(tids[i], NULL);
+	assert(sem_getvalue(sem, &value) == 0 && value == 1);
+	assert(sem_trydown(sem) == 0 && sem_trydown(sem) == -1);
+
+	/* A single resource goes to the waiter behind one needing two */
+	pthread_create(&tids[0], NULL, batch_waiter, NULL);
+	wait_sleepers(1);
+	pthread_create(&tids[1], NULL, waiter, NULL);
+	wait_sleepers(2);
+	sem_up(sem);
+	pthread_join(tids[1], NULL);
+	assert(sem_getvalue(sem, &value) == 0 && value == -1);
+	sem_up_n(sem, 2);
+	pthread_join(tids[0], NULL);
+	assert(sem_getvalue(sem, &value) == 0 && value == 0);
+	assert(sem_destroy(sem) == 0);
+}
+
+int main(void)
+{
+	assert(sem_create_mode(1, 2) == NULL);
+
+	contend(SEM_HANDOFF, "hand-off");
+	contend(SEM_BARGING, "barging");
+	barging_waits();
+
+	printf("Hand-off and barging OK\n");
+	return 0;
+}
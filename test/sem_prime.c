@@ -6,14 +6,25 @@
  * pipeline consists of filtering thread, added dynamically each time a new
  * prime number is found and which filters out subsequent numbers that are
  * multiples of that prime.
+ *
+ * With -p, a scalable version of the same pipeline runs instead, up to 10^7
+ * by default: numbers go down the pipeline in blocks, each stage filters a
+ * whole block with a group of primes, stages run on a bounded pool of worker
+ * threads, and blocks are handed from stage to stage in batches. It reports
+ * primes/sec for a growing number of workers.
  */
 
+#include <assert.h>
 #include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <channel.h>
 #include <sem.h>
 
 #define MAXPRIME 1000
@@ -141,6 +152,258 @@ static void *sink(void *arg)
 	return NULL;
 }
 
+/*
+ * Pipeline mode
+ *
+ * A block holds BLOCK consecutive odd numbers, as flags set once a number is
+ * found to be a multiple of a prime. The primes up to the square root of max
+ * are split into STAGES groups of about the same filtering work, each group
+ * being a stage of the pipeline. Work items are blocks tagged with their next
+ * stage, queued in a single channel: any worker takes a batch of them, runs
+ * each block through its stage, and queues the whole batch back for the next
+ * stages, so that all stages progress at once on different blocks. Blocks
+ * that went through every stage are counted and recycled through a channel of
+ * free blocks, which bounds the number of blocks in flight.
+ */
+#define PIPELINE_MAX	10000000
+#define BLOCK		32768
+#define STAGES		16
+#define INFLIGHT	64
+#define BATCH		8
+#define MAX_WORKERS	64
+
+struct block {
+	uint64_t start;
+	unsigned int stage;
+	unsigned char composite[BLOCK];
+};
+
+struct pipeline {
+	uint64_t max;
+	unsigned int *primes;
+	size_t first[STAGES + 1];
+	channel_t work;
+	channel_t free;
+	sem_t done;
+	size_t blocks;
+	size_t counted;
+	unsigned long found;
+	sem_t mutex;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Finds the odd primes up to @max with a plain sieve, returns their count */
+static size_t plain_sieve(uint64_t max, unsigned int **primes)
+{
+	unsigned char *composite = calloc(max + 1, 1);
+	size_t count = 0;
+	uint64_t i, j;
+
+	for (i = 3; i * i <= max; i += 2)
+		if (!composite[i])
+			for (j = i * i; j <= max; j += 2 * i)
+				composite[j] = 1;
+
+	if (primes)
+		*primes = malloc((max / 2 + 1) * sizeof(unsigned int));
+	for (i = 3; i <= max; i += 2) {
+		if (composite[i])
+			continue;
+		if (primes)
+			(*primes)[count] = i;
+		count++;
+	}
+
+	free(composite);
+	return count;
+}
+
+/* Splits primes into stages of about the same work, which goes as 1/p */
+static void split_stages(struct pipeline *pl, size_t count)
+{
+	double total = 0, sum = 0;
+	size_t i, stage = 1;
+
+	for (i = 0; i < count; i++)
+		total += 1.0 / pl->primes[i];
+
+	pl->first[0] = 0;
+	for (i = 0; i < count && stage < STAGES; i++) {
+		sum += 1.0 / pl->primes[i];
+		if (sum >= total * stage / STAGES)
+			pl->first[stage++] = i + 1;
+	}
+	while (stage <= STAGES)
+		pl->first[stage++] = count;
+}
+
+/* Flags the multiples of the primes of the stage of block @b */
+static void filter_block(struct pipeline *pl, struct block *b)
+{
+	uint64_t end = b->start + 2 * BLOCK, p, m;
+	size_t i;
+
+	for (i = pl->first[b->stage]; i < pl->first[b->stage + 1]; i++) {
+		p = pl->primes[i];
+
+		/* First odd multiple of p in the block, p itself excluded */
+		m = (b->start + p - 1) / p * p;
+		if (m < p * p)
+			m = p * p;
+		if (m % 2 == 0)
+			m += p;
+
+		for (; m < end; m += 2 * p)
+			b->composite[(m - b->start) / 2] = 1;
+	}
+	b->stage++;
+}
+
+/* Counts the primes of a block which went through every stage */
+static unsigned long count_block(struct pipeline *pl, struct block *b)
+{
+	unsigned long count = 0;
+	size_t i;
+
+	for (i = 0; i < BLOCK && b->start + 2 * i <= pl->max; i++)
+		if (!b->composite[i] && b->start + 2 * i > 1)
+			count++;
+
+	return count;
+}
+
+static void *worker(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct block *items[BATCH];
+	unsigned long found;
+	int i, n, next;
+
+	while (1) {
+		n = channel_recv_n(pl->work, (void**)items, BATCH);
+
+		for (i = next = 0; i < n; i++) {
+			/* Leaves the other ends of the pipeline to other workers */
+			if (items[i] == NULL) {
+				channel_send_n(pl->work, (void**)items + i + 1,
+					       n - i - 1);
+				return NULL;
+			}
+
+			if (items[i]->stage < STAGES) {
+				filter_block(pl, items[i]);
+				items[next++] = items[i];
+				continue;
+			}
+
+			found = count_block(pl, items[i]);
+			channel_send(pl->free, items[i]);
+
+			sem_down(pl->mutex);
+			pl->found += found;
+			if (++pl->counted == pl->blocks)
+				sem_up(pl->done);
+			sem_up(pl->mutex);
+		}
+
+		channel_send_n(pl->work, (void**)items, next);
+	}
+}
+
+/* Runs the pipeline with @workers workers, returns the number of primes */
+static unsigned long run_pipeline(struct pipeline *pl, unsigned int workers)
+{
+	pthread_t tids[MAX_WORKERS];
+	struct block *blocks[INFLIGHT], *b;
+	uint64_t start;
+	unsigned int i;
+
+	pl->work = channel_create(INFLIGHT + workers);
+	pl->free = channel_create(INFLIGHT);
+	pl->done = sem_create(0);
+	pl->mutex = sem_create(1);
+	pl->blocks = (pl->max - 1) / (2 * BLOCK) + 1;
+	pl->counted = 0;
+	pl->found = 0;
+
+	for (i = 0; i < INFLIGHT; i++) {
+		blocks[i] = malloc(sizeof(struct block));
+		channel_send(pl->free, blocks[i]);
+	}
+	for (i = 0; i < workers; i++)
+		pthread_create(&tids[i], NULL, worker, pl);
+
+	/* Feeds blocks of numbers as they are recycled */
+	for (start = 1; start <= pl->max; start += 2 * BLOCK) {
+		channel_recv(pl->free, (void**)&b);
+		b->start = start;
+		b->stage = 0;
+		memset(b->composite, 0, BLOCK);
+		channel_send(pl->work, b);
+	}
+
+	sem_down(pl->done);
+	for (i = 0; i < workers; i++)
+		channel_send(pl->work, NULL);
+	for (i = 0; i < workers; i++)
+		pthread_join(tids[i], NULL);
+
+	for (i = 0; i < INFLIGHT; i++)
+		free(blocks[i]);
+	channel_destroy(pl->work);
+	channel_destroy(pl->free);
+	sem_destroy(pl->done);
+	sem_destroy(pl->mutex);
+
+	/* Counts 2, the only even prime */
+	return pl->found + (pl->max >= 2);
+}
+
+static int pipeline(uint64_t max)
+{
+	struct pipeline pl = { .max = max > 0 ? max : 1 };
+	unsigned int workers, maxworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long expected, primes;
+	uint64_t root = 1;
+	double start, elapsed;
+
+	if (maxworkers < 4)
+		maxworkers = 4;
+	if (maxworkers > MAX_WORKERS)
+		maxworkers = MAX_WORKERS;
+
+	while ((root + 1) * (root + 1) <= max)
+		root++;
+	split_stages(&pl, plain_sieve(root, &pl.primes));
+
+	start = now_ns();
+	expected = plain_sieve(max, NULL) + (max >= 2);
+	elapsed = now_ns() - start;
+	printf("plain sieve: %lu primes up to %lu, %12.0f primes/sec\n",
+	       expected, (unsigned long)max, expected / elapsed * 1e9);
+
+	for (workers = 1; workers <= maxworkers; workers *= 2) {
+		start = now_ns();
+		primes = run_pipeline(&pl, workers);
+		elapsed = now_ns() - start;
+		assert(primes == expected);
+
+		printf("%2u workers: %lu primes up to %lu, %12.0f primes/sec\n",
+		       workers, primes, (unsigned long)max,
+		       primes / elapsed * 1e9);
+	}
+
+	free(pl.primes);
+	return 0;
+}
+
 static unsigned int get_argv(char *argv)
 {
 	long int ret = strtol(argv, NULL, 0);
@@ -156,6 +419,9 @@ int main(int argc, char **argv)
 {
 	pthread_t tid;
 
+	if (argc > 1 && !strcmp(argv[1], "-p"))
+		return pipeline(argc > 2 ? get_argv(argv[2]) : PIPELINE_MAX);
+
 	if (argc > 1)
 		max = get_argv(argv[1]);
 
@@ -0,0 +1,146 @@
+/*
+ * Adaptive spinning test
+ *
+ * Two threads hand a resource back and forth through two semaphores, so that
+ * each sem_down() finds no resource and the matching sem_up() comes a moment
+ * later, then a consumer takes resources a producer only releases every
+ * SLOW_US microseconds, which spinning cannot catch. Both are run with
+ * spinning disabled by SEM_NO_SPIN, in a child process since the library
+ * decides whether to spin once, then with the default behaviour, which only
+ * spins on multiprocessors. The time per round and the context switches of
+ * the process per round are printed for each.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+#define ROUNDS		100000
+#define SLOW_ROUNDS	200
+#define SLOW_US		200
+
+static sem_t ping, pong;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long switches(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static void *ponger(void *arg)
+{
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		sem_down(ping);
+		sem_up(pong);
+	}
+
+	return NULL;
+}
+
+static void *producer(void *arg)
+{
+	int i;
+
+	for (i = 0; i < SLOW_ROUNDS; i++) {
+		usleep(SLOW_US);
+		sem_up(ping);
+	}
+
+	return NULL;
+}
+
+static void report(const char *mode, const char *name, sem_t sem, int rounds,
+		   double start, long ctx)
+{
+	struct sem_stats stats;
+	double elapsed = now_ns() - start;
+
+	printf("%-8s %-9s %9.1f ns/round, %6.2f switches/round", mode, name,
+	       elapsed / rounds, (double)(switches() - ctx) / rounds);
+	if (sem_stats(sem, &stats) == 0)
+		printf(", %lu spun", stats.spun);
+	printf("\n");
+}
+
+static void run(const char *mode)
+{
+	struct sem_stats stats;
+	pthread_t tid;
+	double start;
+	long ctx;
+	int i, value;
+
+	ping = sem_create(0);
+	pong = sem_create(0);
+
+	/* Back and forth */
+	ctx = switches();
+	start = now_ns();
+	pthread_create(&tid, NULL, ponger, NULL);
+	for (i = 0; i < ROUNDS; i++) {
+		sem_up(ping);
+		sem_down(pong);
+	}
+	pthread_join(tid, NULL);
+	report(mode, "ping-pong", pong, ROUNDS, start, ctx);
+
+	/* Slow producer */
+	ctx = switches();
+	start = now_ns();
+	pthread_create(&tid, NULL, producer, NULL);
+	for (i = 0; i < SLOW_ROUNDS; i++)
+		sem_down(ping);
+	pthread_join(tid, NULL);
+	report(mode, "slow", ping, SLOW_ROUNDS, start, ctx);
+
+	/* Every resource was taken exactly once */
+	assert(sem_getvalue(ping, &value) == 0 && value == 0);
+	assert(sem_getvalue(pong, &value) == 0 && value == 0);
+
+	/* No resource is ever taken by spinning when it is disabled */
+	if (getenv("SEM_NO_SPIN") != NULL && sem_stats(pong, &stats) == 0)
+		assert(stats.spun == 0);
+	assert(sem_destroy(ping) == 0 && sem_destroy(pong) == 0);
+}
+
+int main(void)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		setenv("SEM_NO_SPIN", "1", 1);
+		run("blocking");
+		exit(0);
+	}
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	run("default");
+
+	printf("Spinning on %ld processor(s) OK\n",
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	return 0;
+}
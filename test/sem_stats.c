@@ -0,0 +1,99 @@
+/*
+ * Semaphore statistics test
+ *
+ * THREADS threads block on a named semaphore until it is released, once they
+ * are all waiting, then resources are taken without waiting. The statistics
+ * of the semaphore must account for every acquisition, wait and wakeup, and
+ * only named semaphores must be dumped. Statistics are only compiled in with
+ * `make S=1`, otherwise sem_stats() and sem_stats_dump() must fail.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+#define THREADS		4
+#define WAIT_US		10000
+
+static sem_t sem;
+
+static void *waiter(void *arg)
+{
+	sem_down(sem);
+	return NULL;
+}
+
+int main(void)
+{
+	struct sem_stats stats;
+	pthread_t tids[THREADS];
+	sem_t unnamed;
+	char *dump = NULL;
+	size_t size;
+	FILE *stream;
+	int i, value;
+
+	sem = sem_create(0);
+	unnamed = sem_create(1);
+	assert(sem_set_name(sem, "waiters") == 0);
+
+	if (sem_stats(sem, &stats) == -1) {
+		assert(sem_stats_dump(stdout) == -1);
+		sem_destroy(sem);
+		sem_destroy(unnamed);
+		printf("Statistics not compiled in\n");
+		return 0;
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tids[i], NULL, waiter, NULL);
+
+	/* Lets all threads wait for a while */
+	do {
+		usleep(1000);
+		sem_getvalue(sem, &value);
+	} while (value > -THREADS);
+	usleep(WAIT_US);
+
+	sem_up_n(sem, THREADS);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(tids[i], NULL);
+
+	/* Takes resources without waiting */
+	sem_up(sem);
+	assert(sem_trydown(sem) == 0);
+	assert(sem_trydown(sem) == -1);
+	sem_down(unnamed);
+
+	assert(sem_stats(sem, &stats) == 0);
+	assert(stats.acquisitions == THREADS + 1);
+	assert(stats.contended == THREADS);
+	assert(stats.wakeups == THREADS);
+	assert(stats.max_depth == THREADS);
+	assert(stats.max_wait_ns >= WAIT_US * 1000ULL);
+	assert(stats.wait_ns >= THREADS * WAIT_US * 1000ULL);
+	assert(stats.wait_ns >= stats.max_wait_ns);
+
+	assert(sem_stats(unnamed, &stats) == 0);
+	assert(stats.acquisitions == 1 && stats.contended == 0);
+
+	/* Only the named semaphore is dumped */
+	stream = open_memstream(&dump, &size);
+	assert(sem_stats_dump(stream) == 0);
+	fclose(stream);
+	assert(strncmp(dump, "waiters: acquisitions=5 contended=4 ", 36) == 0);
+	assert(strchr(dump, '\n') == dump + size - 1);
+	printf("%s", dump);
+	free(dump);
+
+	sem_destroy(sem);
+	sem_destroy(unnamed);
+	printf("Statistics OK\n");
+
+	return 0;
+}
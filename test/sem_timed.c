@@ -0,0 +1,202 @@
+/*
+ * Timed and non-blocking semaphore test
+ *
+ * Saturate a pool of POOL_SIZE resources with many more client threads, each
+ * holding a resource for a while. Clients give up on sem_timeddown() after
+ * TIMEOUT_MS milliseconds, and no wait must last much longer than that. Once
+ * the clients are done, all the resources must be back in the pool.
+ *
+ * Then race timed out waiters against sem_up() to check that a resource is
+ * never lost nor duplicated, alone and with a blocking waiter queued behind
+ * them, which must not be given the resource a timed out waiter kept.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+
+#define POOL_SIZE	2
+#define CLIENTS		16
+#define REQUESTS	50
+#define TIMEOUT_MS	2
+#define HOLD_MS		1
+#define SLACK_MS	50
+#define RACES		2000
+#define RACE_US		100
+
+static sem_t pool;
+static atomic_int served, shed;
+static atomic_long worst_ns;
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static struct timespec deadline(long ns)
+{
+	struct timespec ts;
+
+	ns += now_ns();
+	ts.tv_sec = ns / 1000000000L;
+	ts.tv_nsec = ns % 1000000000L;
+	return ts;
+}
+
+static void *client(void *arg)
+{
+	struct timespec hold = { 0, HOLD_MS * 1000000L };
+	long start, waited, worst;
+	int i;
+
+	for (i = 0; i < REQUESTS; i++) {
+		struct timespec abstime = deadline(TIMEOUT_MS * 1000000L);
+
+		start = now_ns();
+		if (sem_timeddown(pool, &abstime) == 0) {
+			served++;
+			nanosleep(&hold, NULL);
+			sem_up(pool);
+			continue;
+		}
+
+		/* Load is shed, the wait must have been bounded */
+		waited = now_ns() - start;
+		worst = worst_ns;
+		while (waited > worst &&
+		       !atomic_compare_exchange_weak(&worst_ns, &worst, waited))
+			;
+		shed++;
+	}
+
+	return NULL;
+}
+
+static void *racer(void *arg)
+{
+	sem_t sem = arg;
+	struct timespec abstime = deadline(RACE_US * 1000L);
+
+	return (void*)(long)(sem_timeddown(sem, &abstime) == 0);
+}
+
+static void *upper(void *arg)
+{
+	sem_up(arg);
+
+	return NULL;
+}
+
+static atomic_int blocked_done;
+
+static void *blocker(void *arg)
+{
+	sem_t sem = arg;
+
+	assert(sem_down(sem) == 0);
+	atomic_store(&blocked_done, 1);
+
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t tids[CLIENTS];
+	int i, value, taken = 0;
+	sem_t sem;
+
+	pool = sem_create(POOL_SIZE);
+
+	/* Non-blocking operations */
+	assert(sem_trydown(NULL) == -1);
+	assert(sem_timeddown(pool, NULL) == -1);
+	for (i = 0; i < POOL_SIZE; i++)
+		assert(sem_trydown(pool) == 0);
+	assert(sem_trydown(pool) == -1);
+	for (i = 0; i < POOL_SIZE; i++)
+		sem_up(pool);
+	printf("trydown OK!\n");
+
+	/* Bounded waits under saturation */
+	for (i = 0; i < CLIENTS; i++)
+		pthread_create(&tids[i], NULL, client, NULL);
+	for (i = 0; i < CLIENTS; i++)
+		pthread_join(tids[i], NULL);
+
+	sem_getvalue(pool, &value);
+	assert(value == POOL_SIZE);
+	assert(served + shed == CLIENTS * REQUESTS);
+	assert(worst_ns < (TIMEOUT_MS + SLACK_MS) * 1000000L);
+	printf("%d served, %d shed, worst shed wait %.2f ms\n", served, shed,
+	       worst_ns / 1e6);
+	assert(sem_destroy(pool) == 0);
+
+	/* Time-outs racing with sem_up() */
+	sem = sem_create(0);
+	for (i = 0; i < RACES; i++) {
+		struct timespec delay = { 0, (i % (3 * RACE_US)) * 1000L };
+		pthread_t tid;
+		void *ret;
+
+		pthread_create(&tid, NULL, racer, sem);
+		nanosleep(&delay, NULL);
+		sem_up(sem);
+		pthread_join(tid, &ret);
+		taken += (long)ret;
+
+		/* The resource went either to the racer or back to sem */
+		if (!ret)
+			assert(sem_trydown(sem) == 0);
+		sem_getvalue(sem, &value);
+		assert(value == 0);
+	}
+	printf("%d of %d races won by sem_timeddown()\n", taken, RACES);
+
+	/*
+	 * Same with sem_up() from another thread, and a blocking waiter queued
+	 * once the timed out one gave up, maybe while sem_up() is under way
+	 */
+	taken = 0;
+	for (i = 0; i < RACES; i++) {
+		struct timespec delay = { 0, (i % (3 * RACE_US)) * 1000L };
+		struct timespec late = { 0, RACE_US * 1000L };
+		struct timespec settle = { 0, 1000000L };
+		pthread_t tid, up, blocked;
+		void *ret;
+
+		atomic_store(&blocked_done, 0);
+		pthread_create(&tid, NULL, racer, sem);
+		nanosleep(&delay, NULL);
+		pthread_create(&up, NULL, upper, sem);
+		nanosleep(&late, NULL);
+		pthread_create(&blocked, NULL, blocker, sem);
+		pthread_join(tid, &ret);
+		pthread_join(up, NULL);
+		taken += (long)ret;
+
+		/* Exactly one of them got the resource */
+		if (ret) {
+			nanosleep(&settle, NULL);
+			assert(atomic_load(&blocked_done) == 0);
+			sem_up(sem);
+		}
+		pthread_join(blocked, NULL);
+		sem_getvalue(sem, &value);
+		assert(value == 0);
+	}
+	printf("%d of %d races with a blocked waiter won by sem_timeddown()\n",
+	       taken, RACES);
+	assert(sem_destroy(sem) == 0);
+	printf("timeddown OK!\n");
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Semaphore block/wake benchmark
+ *
+ * Two threads hand a single resource back and forth through two semaphores,
+ * so that every sem_down() blocks and every sem_up() wakes the other thread.
+ * Calls to malloc() made by the library are counted by wrapping it at link
+ * time: blocking and waking must not allocate anything.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+
+#define CYCLES	100000
+
+static sem_t ping, pong;
+static unsigned int cycles = CYCLES;
+static atomic_long mallocs;
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	mallocs++;
+	return __real_malloc(size);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *ponger(void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < cycles; i++) {
+		sem_down(ping);
+		sem_up(pong);
+	}
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tid;
+	double start, elapsed;
+	long count;
+	unsigned int i;
+
+	if (argc > 1)
+		cycles = get_argv(argv[1]);
+
+	ping = sem_create(0);
+	pong = sem_create(0);
+	pthread_create(&tid, NULL, ponger, NULL);
+
+	mallocs = 0;
+	start = now_ns();
+	for (i = 0; i < cycles; i++) {
+		sem_up(ping);
+		sem_down(pong);
+	}
+	elapsed = now_ns() - start;
+	count = mallocs;
+
+	pthread_join(tid, NULL);
+	sem_destroy(ping);
+	sem_destroy(pong);
+
+	printf("%u cycles: %.1f ns/cycle, %.2f mallocs/cycle\n", cycles,
+	       elapsed / cycles, (double)count / cycles);
+	assert(count == 0);
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * TPS scaling benchmark
+ *
+ * Populate the TPS API with a growing number of TPS areas, each owned by an
+ * idle thread, and measure the average latency of a small tps_read(),
+ * tps_write() and write through tps_map() issued by one extra thread. The
+ * latency should remain flat no matter how many TPS areas exist.
+ *
+ * It also compares reading SEGMENTS scattered segments with as many calls to
+ * tps_read() against a single call to tps_readv().
+ *
+ * The benchmark runs once with TPS areas protected by mprotect() and once
+ * with memory protection keys, if the system supports them.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define ITERATIONS	100000
+#define ACCESS_SIZE	16
+#define STACK_SIZE	(64 * 1024)
+#define SEGMENTS	8
+
+static sem_t ready, done;
+static unsigned int iterations = ITERATIONS;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Idle thread: owns a TPS area until the measurement is over */
+static void *idle(void *arg)
+{
+	tps_create();
+	sem_up(ready);
+	sem_down(done);
+	tps_destroy();
+
+	return NULL;
+}
+
+/* Measuring thread: times small reads and writes to its own TPS */
+static void *measure(void *arg)
+{
+	unsigned int population = *(unsigned int*)arg;
+	char buffer[ACCESS_SIZE] = "benchmark data";
+	char segments[SEGMENTS][ACCESS_SIZE];
+	struct tps_iovec iov[SEGMENTS];
+	double start, read_ns, write_ns, map_ns, batch_ns, readv_ns;
+	unsigned int i, j;
+
+	tps_create();
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		tps_write(i % (TPS_SIZE - ACCESS_SIZE), ACCESS_SIZE, buffer);
+	write_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		tps_read(i % (TPS_SIZE - ACCESS_SIZE), ACCESS_SIZE, buffer);
+	read_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		char *tps = tps_map(i % (TPS_SIZE - ACCESS_SIZE), ACCESS_SIZE, 1);
+
+		memcpy(tps, buffer, ACCESS_SIZE);
+		tps_unmap();
+	}
+	map_ns = (now_ns() - start) / iterations;
+
+	for (j = 0; j < SEGMENTS; j++) {
+		iov[j].offset = j * (TPS_SIZE / SEGMENTS);
+		iov[j].length = ACCESS_SIZE;
+		iov[j].buffer = segments[j];
+	}
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		for (j = 0; j < SEGMENTS; j++)
+			tps_read(iov[j].offset, iov[j].length, iov[j].buffer);
+	batch_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		tps_readv(iov, SEGMENTS);
+	readv_ns = (now_ns() - start) / iterations;
+
+	printf("%6u TPS areas: read %8.1f ns/op, write %8.1f ns/op, "
+	       "map %8.1f ns/op, %dx read %8.1f ns/op, readv %8.1f ns/op\n",
+	       population + 1, read_ns, write_ns, map_ns, SEGMENTS, batch_ns,
+	       readv_ns);
+
+	tps_destroy();
+
+	return NULL;
+}
+
+static void run(unsigned int population)
+{
+	pthread_t *tids = malloc(population * sizeof(pthread_t));
+	pthread_attr_t attr;
+	pthread_t tid;
+	unsigned int i;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK_SIZE);
+
+	for (i = 0; i < population; i++)
+		pthread_create(&tids[i], &attr, idle, NULL);
+	for (i = 0; i < population; i++)
+		sem_down(ready);
+
+	pthread_create(&tid, &attr, measure, &population);
+	pthread_join(tid, NULL);
+
+	for (i = 0; i < population; i++)
+		sem_up(done);
+	for (i = 0; i < population; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_attr_destroy(&attr);
+	free(tids);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+/* Runs the benchmark in a child process, as tps_init() can only be called once */
+static void bench(int fast_access)
+{
+	unsigned int population;
+
+	if (fork() != 0) {
+		wait(NULL);
+		return;
+	}
+
+	if (!fast_access)
+		setenv("TPS_NO_PKEYS", "1", 1);
+
+	ready = sem_create(0);
+	done = sem_create(0);
+
+	tps_init(1);
+	if (tps_fast_access() != fast_access) {
+		printf("Protection keys are not supported\n");
+		exit(0);
+	}
+	printf("%s protection:\n", fast_access ? "pkey" : "mprotect");
+
+	for (population = 9; population < 10000; population = population * 10 + 9)
+		run(population);
+
+	sem_destroy(ready);
+	sem_destroy(done);
+
+	exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		iterations = get_argv(argv[1]);
+
+	bench(0);
+	bench(1);
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Direct TPS access test
+ *
+ * A thread maps its TPS and updates a counter in place. Another thread clones
+ * the TPS while it is mapped, and must keep seeing the counter as it was at
+ * the time of the clone while the first thread keeps updating it. Reading the
+ * TPS of the other thread while a TPS is mapped, and writing through a TPS
+ * mapped for reading only, must be TPS protection errors.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define UPDATES 1000
+
+static sem_t sem1, sem2;
+static volatile unsigned int *mine, *other;
+
+/* Checks that @fn faults in a child process */
+static void faults(void (*fn)(void))
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		fn();
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+static void read_other(void)
+{
+	printf("%u\n", *other);
+}
+
+static void write_mine(void)
+{
+	(*mine)++;
+}
+
+static void *thread2(void *arg)
+{
+	unsigned int counter;
+
+	/* Clone thread 1's TPS while it is mapped */
+	assert(tps_clone(*(pthread_t*)arg) == 0);
+	other = tps_map(0, sizeof(*other), 0);
+	assert(other != NULL && tps_unmap() == 0);
+	sem_up(sem1);
+	sem_down(sem2);
+
+	/* Thread 1 kept updating its counter, but not ours */
+	assert(tps_read(0, sizeof(counter), (char*)&counter) == 0);
+	assert(counter == UPDATES);
+	printf("thread2: clone OK!\n");
+
+	tps_destroy();
+	return NULL;
+}
+
+static void *thread1(void *arg)
+{
+	pthread_t self = pthread_self(), tid;
+	unsigned int *counter, value, i;
+
+	assert(tps_map(0, sizeof(*counter), 1) == NULL);
+	tps_create();
+
+	/* Update the counter in place */
+	counter = tps_map(0, sizeof(*counter), 1);
+	assert(counter != NULL && *counter == 0);
+	assert(tps_map(0, sizeof(*counter), 1) == NULL);
+	assert(tps_read(0, sizeof(value), (char*)&value) == -1);
+	assert(tps_destroy() == -1);
+	for (i = 0; i < UPDATES; i++)
+		(*counter)++;
+
+	/* Let thread 2 clone our TPS, then keep updating the counter */
+	pthread_create(&tid, NULL, thread2, &self);
+	sem_down(sem1);
+	for (i = 0; i < UPDATES; i++)
+		(*counter)++;
+
+	/* Our mapping gives no access to the TPS of thread 2 */
+	faults(read_other);
+	printf("thread1: isolation OK!\n");
+	sem_up(sem2);
+	pthread_join(tid, NULL);
+
+	assert(tps_unmap() == 0);
+	assert(tps_unmap() == -1);
+	assert(tps_read(0, sizeof(value), (char*)&value) == 0);
+	assert(value == 2 * UPDATES);
+	printf("thread1: map OK!\n");
+
+	/* Writing through a read-only mapping is a protection error */
+	mine = tps_map(0, sizeof(*mine), 0);
+	assert(mine != NULL && *mine == 2 * UPDATES);
+	faults(write_mine);
+	assert(tps_unmap() == 0);
+	printf("thread1: read-only map OK!\n");
+
+	tps_destroy();
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tid;
+
+	sem1 = sem_create(0);
+	sem2 = sem_create(0);
+
+	tps_init(1);
+
+	pthread_create(&tid, NULL, thread1, NULL);
+	pthread_join(tid, NULL);
+
+	sem_destroy(sem1);
+	sem_destroy(sem2);
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * TPS page pool test
+ *
+ * Many short-lived threads create, use and destroy a TPS one after the other,
+ * then a cloned TPS area is copied on write and destroyed. The pages of every
+ * destroyed area must go back to the pool, and new areas must always be
+ * zero-filled even when reusing pages.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define THREADS		2000
+#define AREA_PAGES	4
+
+static sem_t sem1, sem2;
+
+static void print_stats(const char *when)
+{
+	struct tps_pool_stats stats;
+
+	assert(tps_pool_stats(&stats) == 0);
+	printf("%s: %zu pages in use, %zu free, high-water mark %zu\n", when,
+	       stats.pages_in_use, stats.pages_free, stats.pages_high_water);
+}
+
+/* Short-lived thread: its TPS must be zero-filled whatever the pool reuses */
+static void *worker(void *arg)
+{
+	size_t size = *(size_t*)arg;
+	char *buffer = calloc(1, size), *zeros = calloc(1, size);
+
+	assert(tps_create_sized(size) == 0);
+	assert(tps_read(0, size, buffer) == 0);
+	assert(!memcmp(buffer, zeros, size));
+
+	memset(buffer, 'x', size);
+	assert(tps_write(0, size, buffer) == 0);
+	assert(tps_destroy() == 0);
+
+	free(buffer);
+	free(zeros);
+	return NULL;
+}
+
+static void *clone_thread(void *arg)
+{
+	char c = 'b';
+
+	assert(tps_clone(*(pthread_t*)arg) == 0);
+	assert(tps_write(0, 1, &c) == 0);
+	print_stats("After copy-on-write");
+
+	sem_up(sem1);
+	sem_down(sem2);
+	assert(tps_destroy() == 0);
+
+	return NULL;
+}
+
+static void *owner_thread(void *arg)
+{
+	pthread_t self = pthread_self(), tid;
+	char c = 'a';
+
+	assert(tps_create_sized(AREA_PAGES * TPS_SIZE) == 0);
+	assert(tps_write(0, 1, &c) == 0);
+
+	pthread_create(&tid, NULL, clone_thread, &self);
+	sem_down(sem1);
+	assert(tps_destroy() == 0);
+	sem_up(sem2);
+	pthread_join(tid, NULL);
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[] = { TPS_SIZE, 3 * TPS_SIZE + 1, 64 * TPS_SIZE };
+	unsigned int threads = THREADS, i;
+	struct tps_pool_stats stats;
+	pthread_t tid;
+
+	if (argc > 1)
+		threads = get_argv(argv[1]);
+
+	sem1 = sem_create(0);
+	sem2 = sem_create(0);
+	tps_init(1);
+
+	/* Thread churn only ever needs the pages of one TPS area at a time */
+	for (i = 0; i < threads; i++) {
+		pthread_create(&tid, NULL, worker, &sizes[i % 3]);
+		pthread_join(tid, NULL);
+	}
+	print_stats("After thread churn");
+	assert(tps_pool_stats(&stats) == 0);
+	assert(stats.pages_in_use == 0);
+	assert(stats.pages_high_water == 64);
+
+	/* Cloned pages and their copies all go back to the pool */
+	pthread_create(&tid, NULL, owner_thread, NULL);
+	pthread_join(tid, NULL);
+	print_stats("After clone");
+	assert(tps_pool_stats(&stats) == 0);
+	assert(stats.pages_in_use == 0);
+	assert(stats.pages_high_water == 64);
+
+	sem_destroy(sem1);
+	sem_destroy(sem2);
+	return 0;
+}
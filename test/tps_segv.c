@@ -0,0 +1,152 @@
+/*
+ * TPS protection error stress test
+ *
+ * Create a large population of TPS areas, then repeatedly fork a child which
+ * accesses one of these areas directly. Every child must be killed by SIGSEGV
+ * after the page fault handler printed "TPS protection error!". A child
+ * accessing a protected page which is not a TPS area must be killed without
+ * printing the message.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define POPULATION	10000
+#define FAULTS		100
+#define STACK_SIZE	(64 * 1024)
+
+static const char msg[] = "TPS protection error!\n";
+
+static sem_t mutex, ready, done;
+static char **pages;
+
+void *latest_mmap_addr;
+
+void *__real_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+
+void *__wrap_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
+{
+	latest_mmap_addr = __real_mmap(addr, len, prot, flags, fildes, off);
+	return latest_mmap_addr;
+}
+
+/* Owner thread: creates a TPS area and remembers its address */
+static void *owner(void *arg)
+{
+	char **page = (char**)arg;
+
+	sem_down(mutex);
+	tps_create();
+	*page = latest_mmap_addr;
+	sem_up(mutex);
+
+	sem_up(ready);
+	sem_down(done);
+	tps_destroy();
+
+	return NULL;
+}
+
+/* Accesses @adr in a child process, returns 1 if the TPS message was printed */
+static int fault(char *adr)
+{
+	char buffer[sizeof(msg)] = { 0 };
+	int fds[2], status;
+	ssize_t len;
+	pid_t pid;
+
+	assert(!pipe(fds));
+	pid = fork();
+	assert(pid >= 0);
+
+	if (pid == 0) {
+		dup2(fds[1], STDERR_FILENO);
+		adr[0] = '\0';
+		_exit(0);
+	}
+
+	close(fds[1]);
+	len = read(fds[0], buffer, sizeof(buffer) - 1);
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+	return len > 0 && !strcmp(buffer, msg);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int population = POPULATION, faults = FAULTS, seed = 1, i;
+	pthread_t *tids;
+	pthread_attr_t attr;
+	char *other;
+
+	if (argc > 1)
+		population = get_argv(argv[1]);
+	if (argc > 2)
+		faults = get_argv(argv[2]);
+
+	tids = malloc(population * sizeof(pthread_t));
+	pages = malloc(population * sizeof(char*));
+
+	mutex = sem_create(1);
+	ready = sem_create(0);
+	done = sem_create(0);
+
+	tps_init(1);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK_SIZE);
+	for (i = 0; i < population; i++)
+		pthread_create(&tids[i], &attr, owner, &pages[i]);
+	for (i = 0; i < population; i++)
+		sem_down(ready);
+	printf("Created %u TPS areas\n", population);
+
+	/* Faults on random TPS areas are all reported */
+	for (i = 0; i < faults; i++)
+		assert(fault(pages[rand_r(&seed) % population] + i % TPS_SIZE));
+	printf("TPS faults: %u reported\n", faults);
+
+	/* Faults on other protected pages are not */
+	other = mmap(NULL, TPS_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	assert(!fault(other));
+	munmap(other, TPS_SIZE);
+	printf("Other fault: not reported\n");
+
+	for (i = 0; i < population; i++)
+		sem_up(done);
+	for (i = 0; i < population; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_attr_destroy(&attr);
+	sem_destroy(mutex);
+	sem_destroy(ready);
+	sem_destroy(done);
+	free(tids);
+	free(pages);
+
+	return 0;
+}
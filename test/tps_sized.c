@@ -0,0 +1,155 @@
+/*
+ * Multi-page TPS test
+ *
+ * A thread creates a 1 MiB TPS area and fills it, then a second thread clones
+ * it and writes a few bytes straddling two pages in the middle of its copy.
+ * Each thread must only see its own modifications, and accesses must be
+ * bound by the size of the area. The second thread finally scatters writes
+ * over its copy with tps_writev() and gathers them back with tps_readv().
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define AREA_SIZE	(1024 * 1024)
+#define WRITE_OFFSET	(AREA_SIZE / 2 - 32)
+#define WRITE_SIZE	64
+
+static sem_t sem1, sem2;
+static char *expected;
+
+static void check(const char *who, const char *content)
+{
+	char *buffer = malloc(AREA_SIZE);
+
+	memset(buffer, 0, AREA_SIZE);
+	assert(tps_read(0, AREA_SIZE, buffer) == 0);
+	assert(!memcmp(content, buffer, AREA_SIZE));
+	printf("%s: read OK!\n", who);
+	free(buffer);
+}
+
+static void vectored(char *content)
+{
+	char data[3][WRITE_SIZE], back[3][WRITE_SIZE];
+	struct tps_iovec iov[3] = {
+		{ 0, WRITE_SIZE, data[0] },
+		{ AREA_SIZE / 4 - WRITE_SIZE / 2, WRITE_SIZE, data[1] },
+		{ AREA_SIZE - WRITE_SIZE, WRITE_SIZE, data[2] },
+	};
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		memset(data[i], 'c' + i, WRITE_SIZE);
+		memcpy(content + iov[i].offset, data[i], WRITE_SIZE);
+	}
+	assert(tps_writev(iov, 3) == 0);
+	check("thread2", content);
+
+	for (i = 0; i < 3; i++)
+		iov[i].buffer = back[i];
+	assert(tps_readv(iov, 3) == 0);
+	for (i = 0; i < 3; i++)
+		assert(!memcmp(back[i], data[i], WRITE_SIZE));
+
+	/* One bad segment fails the whole call */
+	iov[1].offset = AREA_SIZE;
+	assert(tps_writev(iov, 3) == -1);
+	iov[1].offset = 0;
+	iov[2].buffer = NULL;
+	assert(tps_readv(iov, 3) == -1);
+	assert(tps_readv(iov, 0) == -1);
+	check("thread2", content);
+	printf("thread2: vectored OK!\n");
+}
+
+static void *thread2(void *arg)
+{
+	pthread_t tid = *(pthread_t*)arg;
+	char *content = malloc(AREA_SIZE);
+	char data[WRITE_SIZE];
+
+	/* Clone thread 1's TPS and write in the middle of it */
+	assert(tps_clone(tid) == 0);
+	check("thread2", expected);
+
+	memset(data, 'b', WRITE_SIZE);
+	assert(tps_write(WRITE_OFFSET, WRITE_SIZE, data) == 0);
+	memcpy(content, expected, AREA_SIZE);
+	memcpy(content + WRITE_OFFSET, data, WRITE_SIZE);
+	check("thread2", content);
+
+	/* Out of bound accesses */
+	assert(tps_read(AREA_SIZE - 1, 2, data) == -1);
+	assert(tps_write(AREA_SIZE, 1, data) == -1);
+	assert(tps_read(AREA_SIZE - WRITE_SIZE, WRITE_SIZE, data) == 0);
+	printf("thread2: bounds OK!\n");
+
+	/* Vectored accesses, all or nothing */
+	vectored(content);
+
+
+	sem_up(sem1);
+	sem_down(sem2);
+
+	tps_destroy();
+	free(content);
+	return NULL;
+}
+
+static void *thread1(void *arg)
+{
+	pthread_t tid = pthread_self(), tid2;
+	size_t i;
+
+	assert(tps_create_sized(0) == -1);
+	assert(tps_create_sized(AREA_SIZE) == 0);
+	assert(tps_create() == -1);
+
+	/* A new area is all zeros */
+	memset(expected, 0, AREA_SIZE);
+	check("thread1", expected);
+
+	for (i = 0; i < AREA_SIZE; i++)
+		expected[i] = 'a' + i % 26;
+	assert(tps_write(0, AREA_SIZE, expected) == 0);
+
+	pthread_create(&tid2, NULL, thread2, &tid);
+	sem_down(sem1);
+
+	/* Thread 2's write did not change our TPS */
+	check("thread1", expected);
+
+	sem_up(sem2);
+	pthread_join(tid2, NULL);
+
+	/* Our pages are not shared anymore, and still hold the same content */
+	check("thread1", expected);
+	tps_destroy();
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tid;
+
+	expected = malloc(AREA_SIZE);
+	sem1 = sem_create(0);
+	sem2 = sem_create(0);
+
+	tps_init(1);
+
+	pthread_create(&tid, NULL, thread1, NULL);
+	pthread_join(tid, NULL);
+
+	sem_destroy(sem1);
+	sem_destroy(sem2);
+	free(expected);
+	return 0;
+}
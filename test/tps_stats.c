@@ -0,0 +1,177 @@
+/*
+ * TPS statistics test
+ *
+ * A thread creates a TPS of a few pages and writes to it, another one clones
+ * it and writes to one page, which is copied on write, then both read their
+ * TPS and destroy it. The operations of both threads must be counted, after
+ * they exit too, along with the copy-on-write and the pages shared or not.
+ * The latency of each operation is printed, and that of tps_read() in a loop
+ * is compared with the time it takes on average, to check that timing only
+ * some of the calls is representative.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define AREA_PAGES	4
+#define PAGE_SIZE	4096
+#define READS		100000
+
+static sem_t cloned, written, done;
+static pthread_t owner;
+
+static void check_op(struct tps_stats *stats, enum tps_op op,
+		     unsigned long count)
+{
+	unsigned long sum = 0;
+	int i;
+
+	/* Each thread times its first call, then one in TPS_STATS_PERIOD */
+	assert(stats->ops[op].count == count);
+	assert(stats->ops[op].timed >= 1 && stats->ops[op].timed <= count);
+	for (i = 0; i < TPS_HIST_BUCKETS; i++)
+		sum += stats->ops[op].hist[i];
+	assert(sum == stats->ops[op].timed);
+}
+
+static void *owner_thread(void *arg)
+{
+	char buffer[AREA_PAGES * PAGE_SIZE];
+	struct tps_stats stats;
+
+	memset(buffer, 'a', sizeof(buffer));
+	assert(tps_create_sized(sizeof(buffer)) == 0);
+	assert(tps_write(0, sizeof(buffer), buffer) == 0);
+
+	assert(tps_stats(&stats) == 0);
+	assert(stats.pages_private == AREA_PAGES && stats.pages_shared == 0);
+
+	sem_up(cloned);
+	sem_down(written);
+
+	/* The clone copied a single page */
+	assert(tps_stats(&stats) == 0);
+	assert(stats.cow_copies == 1 && stats.cow_bytes == PAGE_SIZE);
+	assert(stats.pages_shared == AREA_PAGES - 1);
+	assert(stats.pages_private == 2);
+
+	assert(tps_read(0, sizeof(buffer), buffer) == 0);
+	assert(buffer[0] == 'a');
+	assert(tps_destroy() == 0);
+
+	sem_up(done);
+	return NULL;
+}
+
+static void *clone_thread(void *arg)
+{
+	char c = 'b';
+
+	sem_down(cloned);
+	assert(tps_clone(owner) == 0);
+	assert(tps_write(0, 1, &c) == 0);
+	sem_up(written);
+
+	sem_down(done);
+	c = 0;
+	assert(tps_read(0, 1, &c) == 0 && c == 'b');
+	assert(tps_destroy() == 0);
+
+	return NULL;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Compares the sampled latency of tps_read() with its measured average */
+static void sampled_reads(void)
+{
+	struct tps_stats before, after;
+	double start, elapsed, sampled;
+	unsigned long timed;
+	char c;
+	int i;
+
+	assert(tps_create() == 0);
+	assert(tps_stats(&before) == 0);
+
+	start = now_ns();
+	for (i = 0; i < READS; i++)
+		assert(tps_read(0, 1, &c) == 0);
+	elapsed = (now_ns() - start) / READS;
+
+	assert(tps_stats(&after) == 0);
+	assert(tps_destroy() == 0);
+
+	/* The first read of the thread is timed, then one in TPS_STATS_PERIOD */
+	timed = after.ops[TPS_OP_READ].timed - before.ops[TPS_OP_READ].timed;
+	assert(after.ops[TPS_OP_READ].count - before.ops[TPS_OP_READ].count == READS);
+	assert(timed == (READS + TPS_STATS_PERIOD - 1) / TPS_STATS_PERIOD);
+
+	sampled = (double)(after.ops[TPS_OP_READ].total_ns -
+			   before.ops[TPS_OP_READ].total_ns) / timed;
+	printf("tps_read: %.1f ns/call sampled, %.1f ns/call measured\n",
+	       sampled, elapsed);
+	assert(sampled < 4 * elapsed);
+}
+
+int main(void)
+{
+	static const char *names[TPS_OPS] = {
+		"create", "destroy", "read", "write", "clone", "lookup"
+	};
+	struct tps_stats stats;
+	pthread_t tid;
+	int op;
+
+	assert(tps_stats(&stats) == -1);
+	assert(tps_init(0) == 0);
+	assert(tps_stats(NULL) == -1);
+
+	cloned = sem_create(0);
+	written = sem_create(0);
+	done = sem_create(0);
+
+	pthread_create(&owner, NULL, owner_thread, NULL);
+	pthread_create(&tid, NULL, clone_thread, NULL);
+	pthread_join(owner, NULL);
+	pthread_join(tid, NULL);
+
+	/* The counters of both threads were kept when they exited */
+	assert(tps_stats(&stats) == 0);
+	check_op(&stats, TPS_OP_CREATE, 1);
+	check_op(&stats, TPS_OP_DESTROY, 2);
+	check_op(&stats, TPS_OP_READ, 2);
+	check_op(&stats, TPS_OP_WRITE, 2);
+	check_op(&stats, TPS_OP_CLONE, 1);
+	check_op(&stats, TPS_OP_LOOKUP, 9);
+	assert(stats.cow_copies == 1);
+	assert(stats.pages_shared == 0 && stats.pages_private == 0);
+
+	for (op = 0; op < TPS_OPS; op++)
+		printf("%-8s %lu calls, %8.1f ns/call\n", names[op],
+		       stats.ops[op].count,
+		       (double)stats.ops[op].total_ns / stats.ops[op].timed);
+	printf("%lu copies on write, %llu bytes, %lu protection calls\n",
+	       stats.cow_copies, stats.cow_bytes, stats.protect_calls);
+
+	sampled_reads();
+
+	sem_destroy(cloned);
+	sem_destroy(written);
+	sem_destroy(done);
+
+	return 0;
+}